@@ -5,7 +5,20 @@
  * and related and neighboring rights to this software to the public domain
  * worldwide. This software is distributed without any warranty.
  * 
- * See <http://creativecommons.org/publicdomain/zero/1.0/>. */
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * The sums are taken modulo 65521 only every ADLER_NMAX bytes, the largest
+ * number of bytes after which b cannot overflow 32 bits, as in zlib.
+ * On x86-64, blocks of 32 bytes are summed in SIMD registers: a is a sum of
+ * absolute differences with zero, and b the sum of the bytes weighted from
+ * 32 down to 1 (pmaddubsw) plus 32 times the previous values of a. AVX2 is
+ * used when the cpu has it, else SSSE3, else the scalar loop. The choice is
+ * made on the first call, before any thread in hashn_parallel. Define
+ * ADLER_32_PORTABLE to only use the scalar loop.
+ *
+ * adler32_combine follows zlib: the checksum of B is shifted by the length
+ * of A, so that hashn_parallel can checksum parts of a buffer on several
+ * threads. */
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -16,26 +29,329 @@ uint32_t hash(const char* content);
 // use a length parameter to determine the length of the buffer
 uint32_t hashn(const uint8_t* content, size_t length);
 
+// checksum of data coming in pieces, same result as hashn on the whole
+typedef struct {
+  uint32_t a, b;
+} adler32_state;
+
+void adler32_init(adler32_state* state);
+void adler32_update(adler32_state* state, const uint8_t* content,
+                    size_t length);
+uint32_t adler32_final(const adler32_state* state);
+
+// checksum of a buffer A followed by a buffer B of length_b bytes, from the
+// checksum of A and the checksum of B
+uint32_t adler32_combine(uint32_t adler_a, uint32_t adler_b, size_t length_b);
+
+#ifdef __unix__
+// same result as hashn, parts of the buffer summed on nthreads threads, or
+// on the calling thread if nthreads < 2
+uint32_t hashn_parallel(const uint8_t* content, size_t length, int nthreads);
+#endif
+
+// same result as hashn, scalar loop on any cpu
+uint32_t adler32_portable(const uint8_t* content, size_t length);
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ADLER_32_PORTABLE)
+#define ADLER_32_X86
+// SIMD versions, the caller checks that the cpu supports them with
+// __builtin_cpu_supports("ssse3") and __builtin_cpu_supports("avx2")
+uint32_t adler32_ssse3(const uint8_t* content, size_t length);
+uint32_t adler32_avx2(const uint8_t* content, size_t length);
+#endif
+
 #ifdef ADLER_32_IMPLEMENTATION
 
+#include <stdatomic.h>
+#ifdef __unix__
+#include <pthread.h>
+#endif
+#ifdef ADLER_32_X86
+#include <immintrin.h>
+#endif
+
 static const uint16_t ADLER_MOD = 0xFFF1;
 
+// 255 n (n + 1) / 2 + (n + 1) (ADLER_MOD - 1) < 2^32
+#define ADLER_NMAX 5552
+
+// smallest part of a buffer worth a thread in hashn_parallel
+#define ADLER_MIN_PART (256 * 1024)
+
+static void adler32_portable_raw(adler32_state* state, const uint8_t* p,
+                                 size_t length);
+// set by the first adler32_choose, threads choosing at once store the same
+static void (*_Atomic adler32_raw)(adler32_state*, const uint8_t*, size_t);
+
+#ifdef ADLER_32_X86
+static void adler32_ssse3_raw(adler32_state* state, const uint8_t* p,
+                              size_t length);
+static void adler32_avx2_raw(adler32_state* state, const uint8_t* p,
+                             size_t length);
+#endif
+
+static void adler32_choose(void) {
+  if (atomic_load_explicit(&adler32_raw, memory_order_acquire)) {
+    return;
+  }
+#ifdef ADLER_32_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    atomic_store_explicit(&adler32_raw, adler32_avx2_raw,
+                          memory_order_release);
+    return;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    atomic_store_explicit(&adler32_raw, adler32_ssse3_raw,
+                          memory_order_release);
+    return;
+  }
+#endif
+  atomic_store_explicit(&adler32_raw, adler32_portable_raw,
+                        memory_order_release);
+}
+
 uint32_t hash(const char* content) {
   uint16_t a = 1, b = 0;
   while (*content != 0) {
     a = (a + *(content++)) % ADLER_MOD;
     b = (b + a) % ADLER_MOD;
   }
-  return (b << 16) | a;
+  return ((uint32_t)b << 16) | a;
 }
 
 uint32_t hashn(const uint8_t* content, size_t length) {
-  uint16_t a = 1, b = 0;
-  for (int i = 0; i < length; i++) {
-    a = (a + content[i]) % ADLER_MOD;
-    b = (b + a) % ADLER_MOD;
+  adler32_state state;
+  adler32_init(&state);
+  adler32_update(&state, content, length);
+  return adler32_final(&state);
+}
+
+void adler32_init(adler32_state* state) {
+  adler32_choose();
+  state->a = 1;
+  state->b = 0;
+}
+
+void adler32_update(adler32_state* state, const uint8_t* content,
+                    size_t length) {
+  atomic_load_explicit(&adler32_raw, memory_order_acquire)(state, content,
+                                                            length);
+}
+
+static void adler32_portable_raw(adler32_state* state, const uint8_t* p,
+                                 size_t length) {
+  uint32_t a = state->a, b = state->b;
+  size_t n;
+  while (length) {
+    n = length < ADLER_NMAX ? length : ADLER_NMAX;
+    length -= n;
+    for (; n >= 8; n -= 8, p += 8) {
+      a += p[0]; b += a;
+      a += p[1]; b += a;
+      a += p[2]; b += a;
+      a += p[3]; b += a;
+      a += p[4]; b += a;
+      a += p[5]; b += a;
+      a += p[6]; b += a;
+      a += p[7]; b += a;
+    }
+    for (; n; n--) {
+      a += *p++;
+      b += a;
+    }
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+  }
+  state->a = a;
+  state->b = b;
+}
+
+uint32_t adler32_portable(const uint8_t* content, size_t length) {
+  adler32_state state = { 1, 0 };
+  adler32_portable_raw(&state, content, length);
+  return adler32_final(&state);
+}
+
+#ifdef ADLER_32_X86
+
+// horizontal sum of the 32 bit lanes
+__attribute__((target("ssse3")))
+static inline uint32_t adler32_sum128(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+// blocks of 32 bytes as two halves, v_ps sums the values of a before each
+// block, the rest goes to the scalar loop
+__attribute__((target("ssse3")))
+static void adler32_ssse3_raw(adler32_state* state, const uint8_t* p,
+                              size_t length) {
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                     24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                     8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  size_t blocks = length / 32, n;
+  __m128i v_ps, v_s1, v_s2, bytes1, bytes2;
+
+  length -= blocks * 32;
+  while (blocks) {
+    n = blocks < ADLER_NMAX / 32 ? blocks : ADLER_NMAX / 32;
+    blocks -= n;
+    v_ps = _mm_setzero_si128();
+    v_s1 = _mm_setzero_si128();
+    v_s2 = _mm_cvtsi32_si128((int)(state->b + state->a * 32 * n));
+    do {
+      bytes1 = _mm_loadu_si128((const __m128i*)p);
+      bytes2 = _mm_loadu_si128((const __m128i*)(p + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                             _mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                             _mm_maddubs_epi16(bytes2, tap2), ones));
+      p += 32;
+    } while (--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+    state->a = (state->a + adler32_sum128(v_s1)) % ADLER_MOD;
+    state->b = adler32_sum128(v_s2) % ADLER_MOD;
+  }
+  adler32_portable_raw(state, p, length);
+}
+
+// blocks of 32 bytes in one register
+__attribute__((target("avx2")))
+static void adler32_avx2_raw(adler32_state* state, const uint8_t* p,
+                             size_t length) {
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  size_t blocks = length / 32, n;
+  __m256i v_ps, v_s1, v_s2, bytes;
+
+  length -= blocks * 32;
+  while (blocks) {
+    n = blocks < ADLER_NMAX / 32 ? blocks : ADLER_NMAX / 32;
+    blocks -= n;
+    v_ps = _mm256_setzero_si256();
+    v_s1 = _mm256_setzero_si256();
+    v_s2 = _mm256_zextsi128_si256(
+      _mm_cvtsi32_si128((int)(state->b + state->a * 32 * n)));
+    do {
+      bytes = _mm256_loadu_si256((const __m256i*)p);
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(
+                                _mm256_maddubs_epi16(bytes, tap), ones));
+      p += 32;
+    } while (--n);
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+    v_s1 = _mm256_add_epi32(v_s1, _mm256_permute2x128_si256(v_s1, v_s1, 1));
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_permute2x128_si256(v_s2, v_s2, 1));
+    state->a = (state->a + adler32_sum128(_mm256_castsi256_si128(v_s1)))
+      % ADLER_MOD;
+    state->b = adler32_sum128(_mm256_castsi256_si128(v_s2)) % ADLER_MOD;
   }
-  return (b << 16) | a;
+  adler32_portable_raw(state, p, length);
+}
+
+uint32_t adler32_ssse3(const uint8_t* content, size_t length) {
+  adler32_state state = { 1, 0 };
+  adler32_ssse3_raw(&state, content, length);
+  return adler32_final(&state);
+}
+
+uint32_t adler32_avx2(const uint8_t* content, size_t length) {
+  adler32_state state = { 1, 0 };
+  adler32_avx2_raw(&state, content, length);
+  return adler32_final(&state);
+}
+
+#endif
+
+uint32_t adler32_final(const adler32_state* state) {
+  return (state->b << 16) | state->a;
 }
 
+uint32_t adler32_combine(uint32_t adler_a, uint32_t adler_b, size_t length_b) {
+  // sums of B start at a = 1 and b = 0, those of A followed by B at the
+  // sums of A: a grows by a_A - 1 and b by b_A + length_b * (a_A - 1)
+  uint32_t rem = (uint32_t)(length_b % ADLER_MOD);
+  uint32_t a = adler_a & 0xFFFF;
+  uint32_t b = (rem * a) % ADLER_MOD;
+  a += (adler_b & 0xFFFF) + ADLER_MOD - 1;
+  b += (adler_a >> 16) + (adler_b >> 16) + ADLER_MOD - rem;
+  if (a >= ADLER_MOD) a -= ADLER_MOD;
+  if (a >= ADLER_MOD) a -= ADLER_MOD;
+  if (b >= 2 * (uint32_t)ADLER_MOD) b -= 2 * (uint32_t)ADLER_MOD;
+  if (b >= ADLER_MOD) b -= ADLER_MOD;
+  return ((uint32_t)b << 16) | a;
+}
+
+#ifdef __unix__
+
+typedef struct {
+  const uint8_t* content;
+  size_t length;
+  uint32_t adler;
+  pthread_t thread;
+  int started;
+} adler32_part;
+
+static void* adler32_hash_part(void* arg) {
+  adler32_part* part = arg;
+  part->adler = hashn(part->content, part->length);
+  return NULL;
+}
+
+uint32_t hashn_parallel(const uint8_t* content, size_t length, int nthreads) {
+  adler32_part* parts;
+  size_t size;
+  uint32_t adler;
+  int i;
+
+  if (nthreads <= 1) {
+    return hashn(content, length);
+  }
+  if ((size_t)nthreads > length / ADLER_MIN_PART) {
+    nthreads = (int)(length / ADLER_MIN_PART);
+  }
+  if (nthreads <= 1 || !(parts = malloc(nthreads * sizeof(adler32_part)))) {
+    return hashn(content, length);
+  }
+  // the threads only read the chosen implementation
+  adler32_choose();
+  size = length / nthreads;
+  for (i = 0; i < nthreads; i++) {
+    parts[i].content = content + i * size;
+    parts[i].length = i == nthreads - 1 ? length - i * size : size;
+    // the calling thread sums the first part, and any part a thread could
+    // not be started for
+    parts[i].started = i && !pthread_create(&parts[i].thread, NULL,
+                                             adler32_hash_part, &parts[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (parts[i].started) {
+      pthread_join(parts[i].thread, NULL);
+    } else {
+      adler32_hash_part(&parts[i]);
+    }
+  }
+  adler = parts[0].adler;
+  for (i = 1; i < nthreads; i++) {
+    adler = adler32_combine(adler, parts[i].adler, parts[i].length);
+  }
+  free(parts);
+  return adler;
+}
+
+#endif
+
 #endif
@@ -20,6 +20,16 @@ uint32_t hash(const char* content);
 // use a length parameter to determine the length of the buffer
 uint32_t hashn(const uint8_t* content, size_t length);
 
+// checksum of data coming in pieces, same result as hashn on the whole
+typedef struct {
+  uint32_t a, b;
+} adler32x_state;
+
+void adler32x_init(adler32x_state* state);
+void adler32x_update(adler32x_state* state, const uint8_t* content,
+                     size_t length);
+uint32_t adler32x_final(const adler32x_state* state);
+
 #ifdef ADLER_32X_IMPLEMENTATION
 
 static const uint16_t ADLER_MOD = 0xFFF1;
@@ -30,16 +40,34 @@ uint32_t hash(const char* content) {
     a = ((a << 7) + (a >> 9) + *(content++)) % ADLER_MOD;
     b = (b + a) % ADLER_MOD;
   }
-  return (b << 16) | a;
+  return ((uint32_t)b << 16) | a;
 }
 
 uint32_t hashn(const uint8_t* content, size_t length) {
-  uint16_t a = 1 << 9, b = 0;
-  for (int i = 0; i < length; i++) {
+  adler32x_state state;
+  adler32x_init(&state);
+  adler32x_update(&state, content, length);
+  return adler32x_final(&state);
+}
+
+void adler32x_init(adler32x_state* state) {
+  state->a = 1 << 9;
+  state->b = 0;
+}
+
+void adler32x_update(adler32x_state* state, const uint8_t* content,
+                     size_t length) {
+  uint32_t a = state->a, b = state->b;
+  for (size_t i = 0; i < length; i++) {
     a = ((a << 7) + (a >> 9) + content[i]) % ADLER_MOD;
     b = (b + a) % ADLER_MOD;
   }
-  return (b << 16) | a;
+  state->a = a;
+  state->b = b;
+}
+
+uint32_t adler32x_final(const adler32x_state* state) {
+  return (state->b << 16) | state->a;
 }
 
 #endif
@@ -1,15 +1,39 @@
-/* Taken from https://stackoverflow.com/a/21001712/6324751
+/* Bitwise version taken from https://stackoverflow.com/a/21001712/6324751
  * Rewritten to fit the format of other algorithms in this directory.
  *
- * This is the basic CRC-32 calculation with some optimization but no
- * table lookup. The byte reversal is avoided by shifting the crc reg
- * right instead of left and by using a reversed 32-bit word to represent
- * the polynomial.
- * When compiled to Cyclops with GCC, this function executes in 8 + 72n
- * instructions, where n is the number of bytes in the input message. It
- * should be doable in 4 + 61n instructions.
- * If the inner loop is strung out (approx. 5*8 = 40 instructions),
- * it would take about 6 + 46n instructions. */
+ * This is the basic CRC-32 (IEEE 802.3, reversed polynomial 0xEDB88320).
+ * crc32_bitwise is the original loop without table lookup: the byte
+ * reversal is avoided by shifting the crc reg right instead of left and by
+ * using a reversed 32-bit word to represent the polynomial. It takes about
+ * 72 instructions per byte of input.
+ *
+ * hashn uses the slice-by-16 method: 16 tables of 256 entries (16KB) give
+ * the crc of a byte followed by 0 to 15 zero bytes, so that 16 bytes of
+ * input are folded with 16 independent lookups xored together instead of
+ * 128 dependent shifts. Slice-by-8 needs only the first 8KB of the tables,
+ * which is better when the tables do not stay in the L1 cache.
+ *
+ * On x86-64, hashn rather folds 64 bytes per step with carry-less
+ * multiplications (PCLMULQDQ) when the cpu has them, following Intel's
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+ *
+ * crc32c computes CRC-32C (Castagnoli, reversed polynomial 0x82F63B78),
+ * a different checksum with better error detection, used by iSCSI, ext4
+ * and SCTP. SSE4.2 has an instruction for it. Its latency is 3 cycles for
+ * a throughput of 1 per cycle, so crc32c runs three independent streams
+ * over consecutive parts of a block and merges them by shifting the first
+ * crcs over the following parts with lookup tables. Without SSE4.2 it
+ * uses slice-by-8.
+ *
+ * crc32_combine gives the crc of two buffers put end to end from their
+ * crcs, by multiplying the first one by x^(8 length) modulo the polynomial
+ * in O(log length). hashn_parallel uses it to hash parts of a buffer on
+ * several threads.
+ *
+ * The tables are computed, and the implementations chosen with cpuid, on
+ * the first call: the first thread fills them while the others wait, so
+ * the first calls may come from several threads at once. Define
+ * CRC32_PORTABLE to only use the table versions. */
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -19,28 +43,517 @@ uint32_t hash(const char* content);
 // use a length parameter to determine the length of the buffer
 uint32_t hashn(const uint8_t* content, size_t length);
 
+// same results as hashn, one bit at a time without table
+uint32_t crc32_bitwise(const uint8_t* content, size_t length);
+
+// same results as hashn, 8 or 16 bytes per step
+uint32_t crc32_slice8(const uint8_t* content, size_t length);
+uint32_t crc32_slice16(const uint8_t* content, size_t length);
+
+// CRC-32C of the buffer, with the crc32 instruction when available
+uint32_t crc32c(const uint8_t* content, size_t length);
+
+// same results as crc32c, slice-by-8 on any cpu
+uint32_t crc32c_portable(const uint8_t* content, size_t length);
+
+// crc of data coming in pieces, same result as hashn (or crc32c) on the
+// whole
+typedef struct {
+  uint32_t crc;
+} crc32_state;
+
+void crc32_init(crc32_state* state);
+void crc32_update(crc32_state* state, const uint8_t* content, size_t length);
+uint32_t crc32_final(const crc32_state* state);
+
+void crc32c_init(crc32_state* state);
+void crc32c_update(crc32_state* state, const uint8_t* content, size_t length);
+uint32_t crc32c_final(const crc32_state* state);
+
+// crc of a buffer A followed by a buffer B of length_b bytes, from the crc
+// of A and the crc of B
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b);
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b);
+
+#ifdef __unix__
+// same result as hashn, parts of the buffer hashed on nthreads threads, or
+// on the calling thread if nthreads < 2
+uint32_t hashn_parallel(const uint8_t* content, size_t length, int nthreads);
+#endif
+
+// compute the lookup tables and choose the implementations for this cpu,
+// done by the first call of any function, safe from several threads
+void crc32_init_tables(void);
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(CRC32_PORTABLE)
+#define CRC32_X86
+// hardware versions, the caller checks that the cpu supports them with
+// __builtin_cpu_supports("pclmul") and __builtin_cpu_supports("sse4.2")
+uint32_t crc32_pclmul(const uint8_t* content, size_t length);
+uint32_t crc32c_sse42(const uint8_t* content, size_t length);
+#endif
+
 #ifdef CRC32_IMPLEMENTATION
 
+#include <string.h>
+#include <stdatomic.h>
+#ifdef CRC32_X86
+#include <immintrin.h>
+#endif
+#ifdef __unix__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static const uint32_t CRC32_POLY = 0xEDB88320;
+static const uint32_t CRC32C_POLY = 0x82F63B78;
+
+// blocks of the three streams of crc32c_sse42
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+// smallest part of a buffer worth a thread in hashn_parallel
+#define CRC32_MIN_PART (256 * 1024)
+
+// crc32_table[k][n] is the crc of byte n followed by k zero bytes
+static uint32_t crc32_table[16][256];
+static uint32_t crc32c_table[8][256];
+// crc32c_long[k][n] shifts byte k of a crc over CRC32C_LONG zero bytes
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+// CRC32_TABLES_EMPTY, then CRC32_TABLES_FILLING while one thread fills the
+// tables and sets crc32_raw and crc32c_raw, CRC32_TABLES_READY once they
+// can be read
+#define CRC32_TABLES_EMPTY 0
+#define CRC32_TABLES_FILLING 1
+#define CRC32_TABLES_READY 2
+static atomic_int crc32_tables_state = CRC32_TABLES_EMPTY;
+
+// the raw functions work on the register value, before the final inversion
+static uint32_t crc32_slice16_raw(uint32_t crc, const uint8_t* p,
+                                  size_t length);
+static uint32_t crc32c_slice8_raw(uint32_t crc, const uint8_t* p,
+                                  size_t length);
+static uint32_t (*crc32_raw)(uint32_t, const uint8_t*, size_t);
+static uint32_t (*crc32c_raw)(uint32_t, const uint8_t*, size_t);
+
+// a * b modulo the polynomial, with x^0 as the top bit as in the crcs
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b, uint32_t poly) {
+  uint32_t m = (uint32_t)1 << 31, p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b >> 1) ^ (poly & -(b & 1));
+  }
+  return p;
+}
+
+// x^(8n) modulo the polynomial, multiplying a crc by it appends n zeros
+static uint32_t crc32_x8nmodp(size_t n, uint32_t poly) {
+  uint32_t p = (uint32_t)1 << 31, power = (uint32_t)1 << 23;
+  while (n) {
+    if (n & 1) {
+      p = crc32_multmodp(power, p, poly);
+    }
+    power = crc32_multmodp(power, power, poly);
+    n >>= 1;
+  }
+  return p;
+}
+
+static void crc32_fill_table(uint32_t (*table)[256], int count,
+                             uint32_t poly) {
+  uint32_t crc;
+  int j, k, n;
+  for (n = 0; n < 256; n++) {
+    crc = n;
+    for (j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (poly & -(crc & 1));
+    }
+    table[0][n] = crc;
+  }
+  for (n = 0; n < 256; n++) {
+    crc = table[0][n];
+    for (k = 1; k < count; k++) {
+      crc = (crc >> 8) ^ table[0][crc & 0xFF];
+      table[k][n] = crc;
+    }
+  }
+}
+
+static void crc32_fill_shift(uint32_t (*table)[256], size_t zeros,
+                             uint32_t poly) {
+  uint32_t op = crc32_x8nmodp(zeros, poly);
+  int k, n;
+  for (k = 0; k < 4; k++) {
+    for (n = 0; n < 256; n++) {
+      table[k][n] = crc32_multmodp(op, (uint32_t)n << (8 * k), poly);
+    }
+  }
+}
+
+// shift a crc over the zeros of a shift table
+static inline uint32_t crc32_shift(uint32_t (*table)[256], uint32_t crc) {
+  return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF]
+    ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+#ifdef CRC32_X86
+static uint32_t crc32_pclmul_raw(uint32_t crc, const uint8_t* p,
+                                 size_t length);
+static uint32_t crc32c_sse42_raw(uint32_t crc, const uint8_t* p,
+                                 size_t length);
+#endif
+
+void crc32_init_tables(void) {
+  int state = atomic_load_explicit(&crc32_tables_state, memory_order_acquire);
+  if (state == CRC32_TABLES_READY) {
+    return;
+  }
+  if (state != CRC32_TABLES_EMPTY
+      || !atomic_compare_exchange_strong_explicit(&crc32_tables_state, &state,
+                                                  CRC32_TABLES_FILLING,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    // another thread fills them
+    while (atomic_load_explicit(&crc32_tables_state, memory_order_acquire)
+           != CRC32_TABLES_READY) {
+#ifdef __unix__
+      sched_yield();
+#endif
+    }
+    return;
+  }
+  crc32_fill_table(crc32_table, 16, CRC32_POLY);
+  crc32_fill_table(crc32c_table, 8, CRC32C_POLY);
+  crc32_fill_shift(crc32c_long, CRC32C_LONG, CRC32C_POLY);
+  crc32_fill_shift(crc32c_short, CRC32C_SHORT, CRC32C_POLY);
+  crc32_raw = crc32_slice16_raw;
+  crc32c_raw = crc32c_slice8_raw;
+#ifdef CRC32_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    crc32_raw = crc32_pclmul_raw;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_raw = crc32c_sse42_raw;
+  }
+#endif
+  atomic_store_explicit(&crc32_tables_state, CRC32_TABLES_READY,
+                        memory_order_release);
+}
+
+// little endian load, a single mov on x86
+static inline uint32_t crc32_load(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8
+    | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// one word of input already xored with the crc, its bytes followed by
+// `zeros` bytes of other words
+static inline uint32_t crc32_word(uint32_t w, int zeros) {
+  return crc32_table[zeros + 3][w & 0xFF]
+    ^ crc32_table[zeros + 2][(w >> 8) & 0xFF]
+    ^ crc32_table[zeros + 1][(w >> 16) & 0xFF]
+    ^ crc32_table[zeros][w >> 24];
+}
+
+static uint32_t crc32_slice8_raw(uint32_t crc, const uint8_t* p,
+                                 size_t length) {
+  for (; length >= 8; length -= 8, p += 8) {
+    crc = crc32_word(crc32_load(p) ^ crc, 4) ^ crc32_word(crc32_load(p + 4), 0);
+  }
+  while (length--) {
+    crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xFF];
+  }
+  return crc;
+}
+
+static uint32_t crc32_slice16_raw(uint32_t crc, const uint8_t* p,
+                                  size_t length) {
+  for (; length >= 16; length -= 16, p += 16) {
+    crc = crc32_word(crc32_load(p) ^ crc, 12)
+      ^ crc32_word(crc32_load(p + 4), 8)
+      ^ crc32_word(crc32_load(p + 8), 4)
+      ^ crc32_word(crc32_load(p + 12), 0);
+  }
+  return crc32_slice8_raw(crc, p, length);
+}
+
+static uint32_t crc32c_slice8_raw(uint32_t crc, const uint8_t* p,
+                                  size_t length) {
+  uint32_t one, two;
+  for (; length >= 8; length -= 8, p += 8) {
+    one = crc32_load(p) ^ crc;
+    two = crc32_load(p + 4);
+    crc = crc32c_table[7][one & 0xFF] ^ crc32c_table[6][(one >> 8) & 0xFF]
+      ^ crc32c_table[5][(one >> 16) & 0xFF] ^ crc32c_table[4][one >> 24]
+      ^ crc32c_table[3][two & 0xFF] ^ crc32c_table[2][(two >> 8) & 0xFF]
+      ^ crc32c_table[1][(two >> 16) & 0xFF] ^ crc32c_table[0][two >> 24];
+  }
+  while (length--) {
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+  }
+  return crc;
+}
+
+#ifdef CRC32_X86
+
+// three streams over consecutive blocks of `block` bytes, as long as there
+// are three blocks left
+#define CRC32C_STREAMS(block, shift) \
+  while (length >= 3 * (block)) { \
+    uint64_t crc1 = 0, crc2 = 0, w0, w1, w2; \
+    const uint8_t* end = p + (block); \
+    do { \
+      memcpy(&w0, p, 8); \
+      memcpy(&w1, p + (block), 8); \
+      memcpy(&w2, p + 2 * (block), 8); \
+      crc0 = _mm_crc32_u64(crc0, w0); \
+      crc1 = _mm_crc32_u64(crc1, w1); \
+      crc2 = _mm_crc32_u64(crc2, w2); \
+      p += 8; \
+    } while (p < end); \
+    crc0 = crc32_shift(shift, (uint32_t)crc0) ^ crc1; \
+    crc0 = crc32_shift(shift, (uint32_t)crc0) ^ crc2; \
+    p += 2 * (block); \
+    length -= 3 * (block); \
+  }
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_raw(uint32_t crc, const uint8_t* p,
+                                 size_t length) {
+  uint64_t crc0 = crc, w;
+  for (; length && ((uintptr_t)p & 7); length--) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+  }
+  CRC32C_STREAMS(CRC32C_LONG, crc32c_long)
+  CRC32C_STREAMS(CRC32C_SHORT, crc32c_short)
+  for (; length >= 8; length -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    crc0 = _mm_crc32_u64(crc0, w);
+  }
+  for (; length; length--) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+  }
+  return (uint32_t)crc0;
+}
+
+#undef CRC32C_STREAMS
+
+// fold a 128 bit remainder over the next 128 bits of input
+#define CRC32_FOLD(x, k, next) \
+  _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+                              _mm_clmulepi64_si128(x, k, 0x11)), next)
+
+// four remainders in flight over 64 byte steps, then folded into one and
+// reduced to 32 bits with a Barrett reduction
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_raw(uint32_t crc, const uint8_t* p,
+                                 size_t length) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x0, x1, x2, x3;
+
+  if (length < 64) {
+    return crc32_slice16_raw(crc, p, length);
+  }
+  x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p),
+                     _mm_cvtsi32_si128((int)crc));
+  x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+  x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+  x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+  for (p += 64, length -= 64; length >= 64; p += 64, length -= 64) {
+    x0 = CRC32_FOLD(x0, k1k2, _mm_loadu_si128((const __m128i*)p));
+    x1 = CRC32_FOLD(x1, k1k2, _mm_loadu_si128((const __m128i*)(p + 16)));
+    x2 = CRC32_FOLD(x2, k1k2, _mm_loadu_si128((const __m128i*)(p + 32)));
+    x3 = CRC32_FOLD(x3, k1k2, _mm_loadu_si128((const __m128i*)(p + 48)));
+  }
+  x0 = CRC32_FOLD(x0, k3k4, x1);
+  x0 = CRC32_FOLD(x0, k3k4, x2);
+  x0 = CRC32_FOLD(x0, k3k4, x3);
+  for (; length >= 16; p += 16, length -= 16) {
+    x0 = CRC32_FOLD(x0, k3k4, _mm_loadu_si128((const __m128i*)p));
+  }
+
+  // 128 to 64 bits
+  x1 = _mm_clmulepi64_si128(x0, k3k4, 0x10);
+  x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), x1);
+  x1 = _mm_srli_si128(x0, 4);
+  x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, low32), k5k0, 0x00);
+  x0 = _mm_xor_si128(x0, x1);
+
+  // 64 to 32 bits
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x0, low32), poly, 0x10);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x00);
+  x0 = _mm_xor_si128(x0, x1);
+  crc = (uint32_t)_mm_extract_epi32(x0, 1);
+  return crc32_slice16_raw(crc, p, length);
+}
+
+#undef CRC32_FOLD
+
+uint32_t crc32_pclmul(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32_pclmul_raw(0xFFFFFFFF, content, length);
+}
+
+uint32_t crc32c_sse42(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32c_sse42_raw(0xFFFFFFFF, content, length);
+}
+
+#endif
+
 uint32_t hash(const char* content) {
   size_t length = 0;
   while (*(content + length) != 0) length++;
-  return hashn(content, length);
+  return hashn((const uint8_t*)content, length);
 }
 
 uint32_t hashn(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32_raw(0xFFFFFFFF, content, length);
+}
+
+uint32_t crc32_bitwise(const uint8_t* content, size_t length) {
   int j;
-  unsigned int crc, mask;
+  uint32_t crc, mask;
 
   crc = 0xFFFFFFFF;
-  for (int i = 0; i < length; i++) {
+  for (size_t i = 0; i < length; i++) {
     uint8_t byte = content[i];  // Get next byte.
     crc = crc ^ byte;
     for (j = 7; j >= 0; j--) {  // Do eight times.
       mask = -(crc & 1);
-      crc = (crc >> 1) ^ (0xEDB88320 & mask);
+      crc = (crc >> 1) ^ (CRC32_POLY & mask);
     }
   }
   return ~crc;
 }
 
+uint32_t crc32_slice8(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32_slice8_raw(0xFFFFFFFF, content, length);
+}
+
+uint32_t crc32_slice16(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32_slice16_raw(0xFFFFFFFF, content, length);
+}
+
+uint32_t crc32c(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32c_raw(0xFFFFFFFF, content, length);
+}
+
+uint32_t crc32c_portable(const uint8_t* content, size_t length) {
+  crc32_init_tables();
+  return ~crc32c_slice8_raw(0xFFFFFFFF, content, length);
+}
+
+void crc32_init(crc32_state* state) {
+  crc32_init_tables();
+  state->crc = 0xFFFFFFFF;
+}
+
+void crc32_update(crc32_state* state, const uint8_t* content, size_t length) {
+  state->crc = crc32_raw(state->crc, content, length);
+}
+
+uint32_t crc32_final(const crc32_state* state) {
+  return ~state->crc;
+}
+
+void crc32c_init(crc32_state* state) {
+  crc32_init_tables();
+  state->crc = 0xFFFFFFFF;
+}
+
+void crc32c_update(crc32_state* state, const uint8_t* content,
+                   size_t length) {
+  state->crc = crc32c_raw(state->crc, content, length);
+}
+
+uint32_t crc32c_final(const crc32_state* state) {
+  return ~state->crc;
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b) {
+  return crc32_multmodp(crc32_x8nmodp(length_b, CRC32_POLY), crc_a,
+                        CRC32_POLY) ^ crc_b;
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b) {
+  return crc32_multmodp(crc32_x8nmodp(length_b, CRC32C_POLY), crc_a,
+                        CRC32C_POLY) ^ crc_b;
+}
+
+#ifdef __unix__
+
+typedef struct {
+  const uint8_t* content;
+  size_t length;
+  uint32_t crc;
+  pthread_t thread;
+  int started;
+} crc32_part;
+
+static void* crc32_hash_part(void* arg) {
+  crc32_part* part = arg;
+  part->crc = hashn(part->content, part->length);
+  return NULL;
+}
+
+uint32_t hashn_parallel(const uint8_t* content, size_t length, int nthreads) {
+  crc32_part* parts;
+  size_t size;
+  uint32_t crc;
+  int i;
+
+  if (nthreads <= 1) {
+    return hashn(content, length);
+  }
+  if ((size_t)nthreads > length / CRC32_MIN_PART) {
+    nthreads = (int)(length / CRC32_MIN_PART);
+  }
+  if (nthreads <= 1 || !(parts = malloc(nthreads * sizeof(crc32_part)))) {
+    return hashn(content, length);
+  }
+  // the threads only read the tables
+  crc32_init_tables();
+  size = length / nthreads;
+  for (i = 0; i < nthreads; i++) {
+    parts[i].content = content + i * size;
+    parts[i].length = i == nthreads - 1 ? length - i * size : size;
+    // the calling thread hashes the first part, and any part a thread
+    // could not be started for
+    parts[i].started = i && !pthread_create(&parts[i].thread, NULL,
+                                             crc32_hash_part, &parts[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (parts[i].started) {
+      pthread_join(parts[i].thread, NULL);
+    } else {
+      crc32_hash_part(&parts[i]);
+    }
+  }
+  crc = parts[0].crc;
+  for (i = 1; i < nthreads; i++) {
+    crc = crc32_combine(crc, parts[i].crc, parts[i].length);
+  }
+  free(parts);
+  return crc;
+}
+
+#endif
+
 #endif
@@ -14,10 +14,25 @@
  * It also seem to have a more random distribution than Adler.
  * Note that Adler is actually pretty bad. CRC32 is way better and is better
  * than LCH32, but it is also slower.
- * It is inspired by XoShiRo algorithm. */
+ * It is inspired by XoShiRo algorithm.
+ *
+ * The input is mixed in blocks of two bytes, each round depending on the
+ * previous one, so the speed is bound by the latency of a round. hashn
+ * loads 16 bytes at a time and runs the 8 rounds without the per block
+ * bound checks, the remaining bytes are mixed two by two.
+ *
+ * hashn_many hashes many independent messages at once instead, one per
+ * lane of SIMD registers: 16 lanes with AVX-512, 8 with AVX2 and 4 with
+ * SSE2, chosen with cpuid on the first call. All the rounds use 32 bit
+ * xor, add and shifts, so each lane gives the same digest as hashn. The
+ * lanes run together while all their messages have a full block left,
+ * then the lanes of the ended messages are masked. Messages of similar
+ * lengths, such as the keys of a table, make the best use of the lanes.
+ * Define LCH32_PORTABLE to hash them one by one. */
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 // expect a null terminated string
 uint32_t hash(const char* content);
@@ -25,43 +40,321 @@ uint32_t hash(const char* content);
 // use a length parameter to determine the length of the buffer
 uint32_t hashn(const uint8_t* content, size_t length);
 
+// digest of data coming in pieces, same result as hashn on the whole
+typedef struct {
+  uint32_t buf[3];
+  uint32_t digest;
+  // odd byte waiting for the next piece to complete its block
+  uint8_t pending;
+  int has_pending;
+} lch32_state;
+
+void lch32_init(lch32_state* state);
+void lch32_update(lch32_state* state, const uint8_t* content, size_t length);
+uint32_t lch32_final(const lch32_state* state);
+
+// digests of n messages in out, same results as hashn on each
+void hashn_many(const uint8_t* const* contents, const size_t* lengths,
+                size_t n, uint32_t* out);
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LCH32_PORTABLE)
+#define LCH32_X86
+// versions of hashn_many for a given number of lanes, the caller checks that
+// the cpu supports them with __builtin_cpu_supports("avx2") and
+// __builtin_cpu_supports("avx512f")
+void lch32_many_sse2(const uint8_t* const* contents, const size_t* lengths,
+                     size_t n, uint32_t* out);
+void lch32_many_avx2(const uint8_t* const* contents, const size_t* lengths,
+                     size_t n, uint32_t* out);
+void lch32_many_avx512(const uint8_t* const* contents, const size_t* lengths,
+                       size_t n, uint32_t* out);
+#endif
+
 #ifdef LCH32_IMPLEMENTATION
 
 static const uint8_t ash_magic[5] = { 0x96, 0x47, 0xe2, 0xbc, 0x8d };
 
 static inline uint32_t rotl(const uint32_t x, int k) {
-  return (x << k) | (x >> (64 - k));
+  return (x << k) | (x >> (32 - k));
 }
 
 uint32_t hash(const char* content) {
   size_t length = 0;
   while (*(content + length) != 0) length++;
-  return hashn(content, length);
+  return hashn((const uint8_t*)content, length);
 }
 
 uint32_t hashn(const uint8_t* content, size_t length) {
-  uint32_t buf[3] = { 0x51b73064, 0x9f4a5705, 0x7b049943 };
-  uint32_t digest = 0x698a3c57;
+  lch32_state state;
+  lch32_init(&state);
+  lch32_update(&state, content, length);
+  return lch32_final(&state);
+}
+
+// mix a block of two bytes, the first one in the low bits, the last byte
+// of an odd length input is repeated
+static inline void lch32_block(uint32_t* buf, uint32_t* digest,
+                               uint32_t block) {
+  uint32_t t = buf[2] + buf[0];
+  // block | rotl(block, 5) << 16, the block having only 16 bits
+  buf[1] ^= block | (block << 21);
+
+  buf[2] ^= buf[0];
+  *digest ^= buf[1];
+  buf[1] ^= buf[2];
+  buf[0] ^= *digest;
+
+  buf[0] ^= t;
+
+  *digest = rotl(*digest, 23);
+}
+
+// 8 bytes in little endian order
+static inline uint64_t lch32_load(const uint8_t* p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
 
-  for (int i = 0; i < length; i += 2) {
-    uint8_t a = content[i];
-    uint8_t b = (i + 1 < length) ? content[i + 1] : content[i % length];
-    uint16_t block1 = a | (b << 8);
-    uint32_t block2 = rotl(block1, 5);
+static inline void lch32_word(uint32_t* buf, uint32_t* digest, uint64_t w) {
+  lch32_block(buf, digest, (uint32_t)w & 0xFFFF);
+  lch32_block(buf, digest, (uint32_t)(w >> 16) & 0xFFFF);
+  lch32_block(buf, digest, (uint32_t)(w >> 32) & 0xFFFF);
+  lch32_block(buf, digest, (uint32_t)(w >> 48));
+}
 
-    uint64_t t = buf[2] + buf[0];
-    buf[1] ^= block1 | (block2 << 16);
+// mix the whole words of the input in local variables, return the number
+// of bytes mixed
+static size_t lch32_words(lch32_state* state, const uint8_t* p,
+                          size_t length) {
+  uint32_t buf[3] = { state->buf[0], state->buf[1], state->buf[2] };
+  uint32_t digest = state->digest;
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint64_t w0 = lch32_load(p + i), w1 = lch32_load(p + i + 8);
+    lch32_word(buf, &digest, w0);
+    lch32_word(buf, &digest, w1);
+  }
+  if (i + 8 <= length) {
+    lch32_word(buf, &digest, lch32_load(p + i));
+    i += 8;
+  }
+  state->buf[0] = buf[0];
+  state->buf[1] = buf[1];
+  state->buf[2] = buf[2];
+  state->digest = digest;
+  return i;
+}
 
-    buf[2] ^= buf[0];
-    digest ^= buf[1];
-    buf[1] ^= buf[2];
-    buf[0] ^= digest;
+void lch32_init(lch32_state* state) {
+  state->buf[0] = 0x51b73064;
+  state->buf[1] = 0x9f4a5705;
+  state->buf[2] = 0x7b049943;
+  state->digest = 0x698a3c57;
+  state->has_pending = 0;
+}
 
-    buf[0] ^= t;
+void lch32_update(lch32_state* state, const uint8_t* content, size_t length) {
+  size_t i = 0;
+  if (state->has_pending && length) {
+    lch32_block(state->buf, &state->digest,
+                state->pending | content[0] << 8);
+    state->has_pending = 0;
+    i = 1;
+  }
+  i += lch32_words(state, content + i, length - i);
+  for (; i + 1 < length; i += 2) {
+    lch32_block(state->buf, &state->digest,
+                content[i] | content[i + 1] << 8);
+  }
+  if (i < length) {
+    state->pending = content[i];
+    state->has_pending = 1;
+  }
+}
 
-    digest = rotl(digest, 23);
+uint32_t lch32_final(const lch32_state* state) {
+  uint32_t buf[3] = { state->buf[0], state->buf[1], state->buf[2] };
+  uint32_t digest = state->digest;
+  if (state->has_pending) {
+    lch32_block(buf, &digest, state->pending * 0x101);
   }
   return digest;
 }
 
+#ifdef LCH32_X86
+
+#include <stdatomic.h>
+
+#define LCH32_MAX_LANES 16
+
+// lch32_block on every lane, v being a vector type of uint32_t
+#define LCH32_ROUND(v, buf0, buf1, buf2, digest, block) do { \
+    v t_ = buf2 + buf0; \
+    buf1 ^= block | (block << 21); \
+    buf2 ^= buf0; \
+    digest ^= buf1; \
+    buf1 ^= buf2; \
+    buf0 ^= digest ^ t_; \
+    digest = (digest << 23) | (digest >> 9); \
+  } while (0)
+
+// bytes i to i + 7 of a message, an odd last byte repeated as in hashn and
+// zeros after the end. Short ends are read as two overlapping words, or
+// first, middle and last bytes, instead of a loop.
+static inline uint64_t lch32_tail(const uint8_t* p, size_t length, size_t i) {
+  uint64_t w;
+  uint32_t lo, hi;
+  size_t k;
+  if (i + 8 <= length) {
+    return lch32_load(p + i);
+  }
+  if (i >= length) {
+    return 0;
+  }
+  p += i;
+  k = length - i;
+  if (k >= 4) {
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + k - 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    lo = __builtin_bswap32(lo);
+    hi = __builtin_bswap32(hi);
+#endif
+    w = lo | (uint64_t)hi << 8 * (k - 4);
+  } else {
+    w = p[0] | (uint64_t)p[k >> 1] << 8 * (k >> 1)
+      | (uint64_t)p[k - 1] << 8 * (k - 1);
+  }
+  return w | ((uint64_t)p[k - 1] << 8 * k & (0 - (uint64_t)(k & 1)));
+}
+
+// digests of `lanes` messages, each lane gets 8 bytes, 4 blocks, at a time.
+// All the lanes run together while every message has 8 bytes left, then the
+// digest of a lane is kept once its message ended.
+#define LCH32_MANY(name, target, lanes) \
+  target static void name(const uint8_t* const* contents, \
+                          const size_t* lengths, uint32_t* out) { \
+    typedef uint32_t v __attribute__((vector_size(4 * (lanes)))); \
+    typedef uint64_t w __attribute__((vector_size(8 * (lanes)))); \
+    v buf0, buf1, buf2, digest, last, rounds, block, live; \
+    w words; \
+    uint64_t loaded[lanes]; \
+    uint32_t counts[lanes]; \
+    size_t common = SIZE_MAX, longest = 0, i; \
+    int l, k; \
+    for (l = 0; l < (lanes); l++) { \
+      common = lengths[l] / 8 < common ? lengths[l] / 8 : common; \
+      longest = lengths[l] > longest ? lengths[l] : longest; \
+      counts[l] = (uint32_t)((lengths[l] + 1) / 2); \
+    } \
+    memcpy(&rounds, counts, sizeof(rounds)); \
+    buf0 = (v){0} + 0x51b73064; \
+    buf1 = (v){0} + 0x9f4a5705; \
+    buf2 = (v){0} + 0x7b049943; \
+    digest = (v){0} + 0x698a3c57; \
+    for (i = 0; i < common * 8; i += 8) { \
+      for (l = 0; l < (lanes); l++) { \
+        loaded[l] = lch32_load(contents[l] + i); \
+      } \
+      memcpy(&words, loaded, sizeof(words)); \
+      for (k = 0; k < 4; k++) { \
+        block = __builtin_convertvector((words >> 16 * k) & 0xFFFF, v); \
+        LCH32_ROUND(v, buf0, buf1, buf2, digest, block); \
+      } \
+    } \
+    last = digest; \
+    for (; i < longest; i += 8) { \
+      for (l = 0; l < (lanes); l++) { \
+        loaded[l] = lch32_tail(contents[l], lengths[l], i); \
+      } \
+      memcpy(&words, loaded, sizeof(words)); \
+      for (k = 0; k < 4; k++) { \
+        block = __builtin_convertvector((words >> 16 * k) & 0xFFFF, v); \
+        LCH32_ROUND(v, buf0, buf1, buf2, digest, block); \
+        live = (v)((v){0} + (uint32_t)(i / 2 + k) < rounds); \
+        last = (digest & live) | (last & ~live); \
+      } \
+    } \
+    memcpy(out, &last, sizeof(last)); \
+  }
+
+LCH32_MANY(lch32_many4, , 4)
+LCH32_MANY(lch32_many8, __attribute__((target("avx2"))), 8)
+LCH32_MANY(lch32_many16, __attribute__((target("avx512f"))), 16)
+
+#undef LCH32_MANY
+#undef LCH32_ROUND
+
+typedef void (*lch32_kernel)(const uint8_t* const*, const size_t*,
+                             uint32_t*);
+
+// whole groups of lanes, then the last messages with empty ones
+static void lch32_many_lanes(lch32_kernel kernel, int lanes,
+                             const uint8_t* const* contents,
+                             const size_t* lengths, size_t n,
+                             uint32_t* out) {
+  const uint8_t* last_contents[LCH32_MAX_LANES];
+  size_t last_lengths[LCH32_MAX_LANES] = {0};
+  uint32_t last_out[LCH32_MAX_LANES];
+  size_t i, rest;
+  for (i = 0; i + lanes <= n; i += lanes) {
+    kernel(contents + i, lengths + i, out + i);
+  }
+  if (i < n) {
+    rest = n - i;
+    memcpy(last_contents, contents + i, rest * sizeof(uint8_t*));
+    memcpy(last_lengths, lengths + i, rest * sizeof(size_t));
+    kernel(last_contents, last_lengths, last_out);
+    memcpy(out + i, last_out, rest * sizeof(uint32_t));
+  }
+}
+
+void lch32_many_sse2(const uint8_t* const* contents, const size_t* lengths,
+                     size_t n, uint32_t* out) {
+  lch32_many_lanes(lch32_many4, 4, contents, lengths, n, out);
+}
+
+void lch32_many_avx2(const uint8_t* const* contents, const size_t* lengths,
+                     size_t n, uint32_t* out) {
+  lch32_many_lanes(lch32_many8, 8, contents, lengths, n, out);
+}
+
+void lch32_many_avx512(const uint8_t* const* contents, const size_t* lengths,
+                       size_t n, uint32_t* out) {
+  lch32_many_lanes(lch32_many16, 16, contents, lengths, n, out);
+}
+
+// set by the first hashn_many, threads choosing at once store the same
+static void (*_Atomic lch32_many)(const uint8_t* const*, const size_t*,
+                                  size_t, uint32_t*);
+
+void hashn_many(const uint8_t* const* contents, const size_t* lengths,
+                size_t n, uint32_t* out) {
+  void (*many)(const uint8_t* const*, const size_t*, size_t, uint32_t*)
+    = atomic_load_explicit(&lch32_many, memory_order_acquire);
+  if (!many) {
+    __builtin_cpu_init();
+    many = __builtin_cpu_supports("avx512f") ? lch32_many_avx512
+      : __builtin_cpu_supports("avx2") ? lch32_many_avx2 : lch32_many_sse2;
+    atomic_store_explicit(&lch32_many, many, memory_order_release);
+  }
+  many(contents, lengths, n, out);
+}
+
+#else
+
+void hashn_many(const uint8_t* const* contents, const size_t* lengths,
+                size_t n, uint32_t* out) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    out[i] = hashn(contents[i], lengths[i]);
+  }
+}
+
+#endif
+
 #endif
@@ -0,0 +1,181 @@
+/* Taken from https://github.com/wangyi-fudan/wyhash (final version 4)
+ * by Wang Yi, released into the public domain (The Unlicense).
+ * Rewritten to fit the format of other algorithms in this directory.
+ *
+ * wyhash is a fast 64 bit hash with a good distribution (it passes
+ * SMHasher). Its only mixing primitive is the 64x64 -> 128 bit
+ * multiplication, whose two halves are xored together:
+ * - up to 16 bytes, the input is read as two overlapping words without a
+ *   loop, which is the common case for hash table keys,
+ * - above 48 bytes, three independent lanes each mix 16 bytes per step,
+ *   so that the multiplications overlap in the pipeline.
+ * The output is the same on every platform, and the same as the reference
+ * wyhash(key, len, seed, _wyp).
+ *
+ * wyhash_seeded gives unrelated hashes for different seeds. With a seed
+ * kept secret, such as one drawn at startup, inputs cannot be chosen to
+ * collide in a hash table. wyhash_string hashes the string keys of
+ * structures/hashtable.h with a seed set by wyhash_set_seed.
+ *
+ * hashn_many hashes a batch of keys. SIMD units have no 64 bit high
+ * multiplication, so that the keys are not spread over vector lanes. The
+ * seed is mixed once for the whole batch instead, and the multiplications
+ * of consecutive keys overlap in the pipeline since the next key does not
+ * wait for the previous digest. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// expect a null terminated string
+uint64_t hash(const char* content);
+
+// use a length parameter to determine the length of the buffer
+uint64_t hashn(const uint8_t* content, size_t length);
+
+// same as hashn with a seed, hashn uses the seed 0
+uint64_t wyhash_seeded(const uint8_t* content, size_t length, uint64_t seed);
+
+// hash function for null terminated string keys of a HashTable, to be given
+// to ht_set_hash_function, seeded with the last wyhash_set_seed
+unsigned long wyhash_string(const void* key);
+void wyhash_set_seed(uint64_t seed);
+
+// digests of n messages in out, same results as hashn on each
+void hashn_many(const uint8_t* const* contents, const size_t* lengths,
+                size_t n, uint64_t* out);
+
+#ifdef WYHASH_IMPLEMENTATION
+
+static const uint64_t wyhash_secret[4] = {
+  0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+  0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+static uint64_t wyhash_string_seed = 0;
+
+// 128 bit product of a and b, low half in a and high half in b
+static inline void wyhash_mum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 wyhash_u128;
+  wyhash_u128 r = (wyhash_u128)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+  wyhash_mum(&a, &b);
+  return a ^ b;
+}
+
+// little endian loads
+static inline uint64_t wyhash_r8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static inline uint64_t wyhash_r4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+// 1 to 3 bytes, first, middle and last
+static inline uint64_t wyhash_r3(const uint8_t* p, size_t k) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+// wyhash_seeded once the seed is mixed with the secret, which hashn_many
+// does a single time for all its keys
+static inline uint64_t wyhash_mixed(const uint8_t* p, size_t length,
+                                    uint64_t seed) {
+  const uint64_t* s = wyhash_secret;
+  uint64_t a, b;
+  size_t i = length;
+
+  if (length <= 16) {
+    if (length >= 4) {
+      // two or four overlapping 4 byte reads
+      a = (wyhash_r4(p) << 32) | wyhash_r4(p + ((length >> 3) << 2));
+      b = (wyhash_r4(p + length - 4) << 32)
+        | wyhash_r4(p + length - 4 - ((length >> 3) << 2));
+    } else if (length > 0) {
+      a = wyhash_r3(p, length);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (i >= 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wyhash_mix(wyhash_r8(p) ^ s[1], wyhash_r8(p + 8) ^ seed);
+        see1 = wyhash_mix(wyhash_r8(p + 16) ^ s[2], wyhash_r8(p + 24) ^ see1);
+        see2 = wyhash_mix(wyhash_r8(p + 32) ^ s[3], wyhash_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wyhash_mix(wyhash_r8(p) ^ s[1], wyhash_r8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    // last 16 bytes, overlapping the previous ones
+    a = wyhash_r8(p + i - 16);
+    b = wyhash_r8(p + i - 8);
+  }
+  a ^= s[1];
+  b ^= seed;
+  wyhash_mum(&a, &b);
+  return wyhash_mix(a ^ s[0] ^ length, b ^ s[1]);
+}
+
+uint64_t wyhash_seeded(const uint8_t* p, size_t length, uint64_t seed) {
+  seed ^= wyhash_mix(seed ^ wyhash_secret[0], wyhash_secret[1]);
+  return wyhash_mixed(p, length, seed);
+}
+
+uint64_t hash(const char* content) {
+  return hashn((const uint8_t*)content, strlen(content));
+}
+
+uint64_t hashn(const uint8_t* content, size_t length) {
+  return wyhash_seeded(content, length, 0);
+}
+
+void hashn_many(const uint8_t* const* contents, const size_t* lengths,
+                size_t n, uint64_t* out) {
+  uint64_t seed = wyhash_mix(wyhash_secret[0], wyhash_secret[1]);
+  size_t i;
+  for (i = 0; i < n; i++) {
+    out[i] = wyhash_mixed(contents[i], lengths[i], seed);
+  }
+}
+
+unsigned long wyhash_string(const void* key) {
+  return (unsigned long)wyhash_seeded(key, strlen(key), wyhash_string_seed);
+}
+
+void wyhash_set_seed(uint64_t seed) {
+  wyhash_string_seed = seed;
+}
+
+#endif
@@ -0,0 +1,467 @@
+/*--------------------------------------------------------------------------*\
+ * Typed AVL tree by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Same tree as structures/avl.h, but generated for a given key type. Keys
+ * are stored by value in the nodes and compared by an inlined expression
+ * instead of a comparator call on boxed keys, so there is no allocation per
+ * key and one less pointer to follow per visited node.
+ *
+ * This file is a template, include it once per key type after defining:
+ *   AVLT_TYPE     name of the tree type, the node type is AVLT_TYPE##Node
+ *   AVLT_PREFIX   prefix of the functions
+ *   AVLT_KEY      type of the keys
+ *   AVLT_CMP(a,b) (optional) expression comparing two keys a and b,
+ *                 <0, 0 or >0 like strcmp. Defaults to comparing with < and >
+ *   AVLT_INTERVAL (optional) make it an interval tree, see below
+ * All of them are undefined at the end of the file.
+ *
+ * For example:
+ *   #define AVLT_TYPE U64Tree
+ *   #define AVLT_PREFIX u64t
+ *   #define AVLT_KEY uint64_t
+ *   #include "avlt.h"
+ * declares U64Tree, U64TreeNode, u64t_insert(U64Tree*, uint64_t, void*)...
+ *
+ * Keys are copied, nothing is done to destroy them. If AVLT_KEY is a
+ * pointer the user keeps ownership of the pointed memory.
+ *
+ * Documentation is the one of avl.h, with the prefix replaced.
+ *
+ * With AVLT_INTERVAL, the keys are the starts of closed intervals
+ * [key, end] and _insert takes the end after the key. Each node also keeps
+ * the maximum end of its subtree, maintained in _update_depth, so that
+ * _overlaps only visits the subtrees holding intervals that overlap the
+ * query.
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if AVLT_IMPLEMENTATION
+ * is defined, it is also undefined at the end of the file.
+ * Jump to AVLT_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#if !defined(AVLT_TYPE) || !defined(AVLT_PREFIX) || !defined(AVLT_KEY)
+#error "AVLT_TYPE, AVLT_PREFIX and AVLT_KEY must be defined"
+#endif
+
+#ifndef AVLT_H
+#define AVLT_H
+
+/* memory allocation macros, change as necessary */
+#define AVLT_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define AVLT_FREE(variable) free(variable)
+#include <stdlib.h> /* for malloc() */
+
+#define AVLT_CAT_(a, b) a##b
+#define AVLT_CAT(a, b) AVLT_CAT_(a, b)
+
+#define AVLT_LEFT 0
+#define AVLT_RIGHT 1
+
+#endif
+
+#ifndef AVLT_CMP
+#define AVLT_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#define AVLT_NODE AVLT_CAT(AVLT_TYPE, Node)
+#define AVLT_FN(name) AVLT_CAT(AVLT_PREFIX, name)
+
+#ifdef AVLT_INTERVAL
+#define AVLT_END_PARAM , AVLT_KEY end
+#define AVLT_END_ARG , end
+#else
+#define AVLT_END_PARAM
+#define AVLT_END_ARG
+#endif
+
+typedef void (*AVLT_FN(_node_visitor_f))(AVLT_KEY key, void* data);
+
+typedef struct AVLT_NODE {
+  struct AVLT_NODE* left,* right;
+  int depth;
+
+  AVLT_KEY key;
+  void* data;
+#ifdef AVLT_INTERVAL
+  AVLT_KEY end;
+  /* maximum end in the subtree */
+  AVLT_KEY max_end;
+#endif
+} AVLT_NODE;
+
+typedef struct {
+  AVLT_NODE* root;
+} AVLT_TYPE;
+
+/* initialize a new tree */
+void AVLT_FN(_initialize)(AVLT_TYPE* tree);
+/* destroy a tree, visitor (may be NULL) is applied on each pair before */
+void AVLT_FN(_destroy)(AVLT_TYPE* tree, AVLT_FN(_node_visitor_f) visitor);
+/* return the data of key or NULL, O(log(n)) */
+void* AVLT_FN(_search)(AVLT_TYPE* tree, AVLT_KEY key);
+/* insert or replace, return the old data or NULL, O(log(n)) */
+void* AVLT_FN(_insert)(AVLT_TYPE* tree, AVLT_KEY key AVLT_END_PARAM,
+                       void* data);
+/* remove key, return its data or NULL, O(log(n)) */
+void* AVLT_FN(_remove)(AVLT_TYPE* tree, AVLT_KEY key);
+/* return the depth of the tree, O(1) */
+int AVLT_FN(_tree_depth)(AVLT_TYPE* tree);
+
+#ifdef AVLT_INTERVAL
+typedef void (*AVLT_FN(_interval_visitor_f))(AVLT_KEY start, AVLT_KEY end,
+                                             void* data);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      _overlaps() - visit the intervals overlapping [lo, hi]
+ *  DESCRIPTION:
+ *      Apply visitor on each interval [start, end] such that start <= hi
+ *      and end >= lo, in increasing order of start, and return their
+ *      number. visitor may be NULL to only count them.
+ *      Subtrees ending before lo or starting after hi are skipped, so
+ *      only the ancestors of the k visited intervals and the search path
+ *      of hi are walked.
+ *  EFFICIENCY:
+ *      O(log(n) + k log(n / k)), and O(log(n) + k) when the overlapping
+ *      intervals are consecutive in the tree, as with intervals of similar
+ *      lengths
+\*--------------------------------------------------------------------------*/
+int AVLT_FN(_overlaps)(AVLT_TYPE* tree, AVLT_KEY lo, AVLT_KEY hi,
+                       AVLT_FN(_interval_visitor_f) visitor);
+#endif
+
+#ifdef AVLT_IMPLEMENTATION
+/* required definitions */
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+/* recursive destruction helper */
+static void AVLT_FN(_destroy_helper)(AVLT_NODE* node,
+                                     AVLT_FN(_node_visitor_f) visitor);
+/* recursive insertion helper */
+static void* AVLT_FN(_insert_helper)(AVLT_NODE** node,
+                                     AVLT_KEY key AVLT_END_PARAM, void* data);
+/* recursive removal helper, finds the appropriate node to remove */
+static void* AVLT_FN(_remove_helper)(AVLT_NODE** node, AVLT_KEY key);
+/* recursive removal helper, detaches the maximum node of a subtree and
+ * rebalances the path to it */
+static AVLT_NODE* AVLT_FN(_remove_max)(AVLT_NODE** node);
+
+/* rotates a node and its left/right child as appropriate (left=0, right=1) */
+static void AVLT_FN(_rotate)(AVLT_NODE** ptr, int which);
+/* performs rotations to appropriately rebalance a node and its children */
+static void AVLT_FN(_rebalance)(AVLT_NODE** ptr);
+/* calculates how out-of-balance a node is (>0 if left deeper) */
+static int AVLT_FN(_balance_factor)(AVLT_NODE* ptr);
+/* recalculates the depth of a node, and its maximum end */
+static void AVLT_FN(_update_depth)(AVLT_NODE* ptr);
+#ifdef AVLT_INTERVAL
+/* recursive overlap query helper */
+static int AVLT_FN(_overlaps_helper)(AVLT_NODE* node, AVLT_KEY lo, AVLT_KEY hi,
+                                     AVLT_FN(_interval_visitor_f) visitor);
+#endif
+
+void AVLT_FN(_initialize)(AVLT_TYPE* tree) {
+  tree->root = NULL;
+}
+
+void AVLT_FN(_destroy)(AVLT_TYPE* tree, AVLT_FN(_node_visitor_f) visitor) {
+  AVLT_FN(_destroy_helper)(tree->root, visitor);
+  tree->root = NULL;
+}
+
+static void AVLT_FN(_destroy_helper)(AVLT_NODE* node,
+                                     AVLT_FN(_node_visitor_f) visitor) {
+
+  if (node == NULL) {
+    return;
+  }
+
+  if (visitor) {
+    visitor(node->key, node->data);
+  }
+  AVLT_FN(_destroy_helper)(node->left, visitor);
+  AVLT_FN(_destroy_helper)(node->right, visitor);
+
+  AVLT_FREE(node);
+}
+
+void* AVLT_FN(_search)(AVLT_TYPE* tree, AVLT_KEY key) {
+  AVLT_NODE* node = tree->root;
+  int cmp;
+  while (node) {
+    cmp = AVLT_CMP(key, node->key);
+    if (cmp == 0) {
+      return node->data;
+    } else if (cmp < 0) {
+      node = node->left;
+    } else {  /* if(cmp > 0) */
+      node = node->right;
+    }
+  }
+  return NULL;
+}
+
+void* AVLT_FN(_insert)(AVLT_TYPE* tree, AVLT_KEY key AVLT_END_PARAM,
+                       void* data) {
+  return AVLT_FN(_insert_helper)(&tree->root, key AVLT_END_ARG, data);
+}
+
+static void* AVLT_FN(_insert_helper)(AVLT_NODE** node,
+                                     AVLT_KEY key AVLT_END_PARAM, void* data) {
+
+  int cmp;
+  void* ret;
+
+  /* if the search leads us to an empty location, then add the new node.
+   * rebalancing, if required, will be handled by the parent call in the
+   * recursion. */
+  if (!*node) {
+    AVLT_ALLOC(*node, AVLT_NODE);
+    (*node)->depth = 1;
+    (*node)->key = key;
+    (*node)->data = data;
+    (*node)->left = (*node)->right = NULL;
+#ifdef AVLT_INTERVAL
+    (*node)->end = (*node)->max_end = end;
+#endif
+
+    return NULL;
+  }
+
+  cmp = AVLT_CMP(key, (*node)->key);
+  if (cmp == 0) {
+    /* if we find a node with the same value, then replace the contents.
+     * no rebalancing is required, but will be checked by parent recursion
+     * call nonetheless. */
+    void* old = (*node)->data;
+    (*node)->data = data;
+#ifdef AVLT_INTERVAL
+    (*node)->end = end;
+    AVLT_FN(_update_depth)(*node);
+#endif
+    return old;
+  } else if (cmp < 0) {
+    ret = AVLT_FN(_insert_helper)(&(*node)->left, key AVLT_END_ARG, data);
+  } else {  /*if(cmp > 0) */
+    ret = AVLT_FN(_insert_helper)(&(*node)->right, key AVLT_END_ARG, data);
+  }
+
+  /* check, and rebalance the current node, if necessary */
+  AVLT_FN(_rebalance)(node);
+  /* ensure the depth of this node is correct */
+  AVLT_FN(_update_depth)(*node);
+
+  return ret;
+}
+
+void* AVLT_FN(_remove)(AVLT_TYPE* tree, AVLT_KEY key) {
+  return AVLT_FN(_remove_helper)(&tree->root, key);
+}
+
+static void* AVLT_FN(_remove_helper)(AVLT_NODE** node, AVLT_KEY key) {
+
+  int cmp;
+  void* ret;
+
+  /* if we didn't find the node, then, well . . . */
+  if (!*node) {
+    return NULL;
+  }
+
+  cmp = AVLT_CMP(key, (*node)->key);
+
+  if (cmp < 0) {
+    ret = AVLT_FN(_remove_helper)(&(*node)->left, key);
+  } else if (cmp > 0) {
+    ret = AVLT_FN(_remove_helper)(&(*node)->right, key);
+  } else {  /* if(cmp == 0) */
+    /* node found. */
+    AVLT_NODE* p = NULL;
+
+    ret = (*node)->data;
+
+    /* complicated case */
+    if ((*node)->left && (*node)->right) {
+      /* use maximum node in left subtree as the replacement */
+      p = AVLT_FN(_remove_max)(&(*node)->left);
+
+      /* copy contents out */
+      (*node)->key = p->key;
+      (*node)->data = p->data;
+#ifdef AVLT_INTERVAL
+      (*node)->end = p->end;
+#endif
+      AVLT_FREE(p);
+    } else if ((*node)->left) {
+      /* no right subtree, so replace this node with the left subtree */
+      p = (*node)->left;
+      AVLT_FREE(*node);
+      *node = p;
+    } else if ((*node)->right) {
+      /* no left subtree, so replace this node with the right subtree */
+      p = (*node)->right;
+      AVLT_FREE(*node);
+      *node = p;
+    } else {
+      /* no children at all, i.e. a leaf */
+      AVLT_FREE(*node);
+      *node = NULL;
+    }
+  }
+
+  /* if the node was replaced, ensure the depth is correct and that
+   * everything is balanced */
+  if (*node) {
+    AVLT_FN(_update_depth)(*node);
+    AVLT_FN(_rebalance)(node);
+  }
+
+  return ret;
+}
+
+static AVLT_NODE* AVLT_FN(_remove_max)(AVLT_NODE** node) {
+  AVLT_NODE* max;
+
+  if (!(*node)->right) {
+    /* replace it with its left child, if any */
+    max = *node;
+    *node = max->left;
+    return max;
+  }
+
+  max = AVLT_FN(_remove_max)(&(*node)->right);
+  AVLT_FN(_update_depth)(*node);
+  AVLT_FN(_rebalance)(node);
+  return max;
+}
+
+static void AVLT_FN(_rebalance)(AVLT_NODE** node) {
+  int delta = AVLT_FN(_balance_factor)(*node);
+
+  /* two rotation directions */
+  if (delta == 2) {
+    if (AVLT_FN(_balance_factor)((*node)->left) < 0) {
+      AVLT_FN(_rotate)(&(*node)->left, AVLT_LEFT);
+    }
+    AVLT_FN(_rotate)(node, AVLT_RIGHT);
+  } else if (delta == -2) {
+    if (AVLT_FN(_balance_factor)((*node)->right) > 0) {
+      AVLT_FN(_rotate)(&(*node)->right, AVLT_RIGHT);
+    }
+    AVLT_FN(_rotate)(node, AVLT_LEFT);
+  }
+}
+
+static void AVLT_FN(_rotate)(AVLT_NODE** node, int dir) {
+  AVLT_NODE* ch;
+
+  /* standard tree rotations */
+  if (dir == 0) {
+    ch = (*node)->right;
+
+    (*node)->right = (*node)->right->left;
+    ch->left = *node;
+    AVLT_FN(_update_depth)(*node);
+    *node = ch;
+  } else {
+    ch = (*node)->left;
+
+    (*node)->left = (*node)->left->right;
+    ch->right = *node;
+    AVLT_FN(_update_depth)(*node);
+    *node = ch;
+  }
+  AVLT_FN(_update_depth)(*node);
+}
+
+static int AVLT_FN(_balance_factor)(AVLT_NODE* ptr) {
+  int delta = 0;
+  if (ptr->left) {
+    delta = ptr->left->depth;
+  }
+  if (ptr->right) {
+    delta -= ptr->right->depth;
+  }
+  return delta;
+}
+
+static void AVLT_FN(_update_depth)(AVLT_NODE* ptr) {
+  ptr->depth = 0;
+  if (ptr->left) {
+    ptr->depth = ptr->left->depth;
+  }
+  if (ptr->right && ptr->depth < ptr->right->depth) {
+    ptr->depth = ptr->right->depth;
+  }
+  ptr->depth++;
+
+#ifdef AVLT_INTERVAL
+  ptr->max_end = ptr->end;
+  if (ptr->left && AVLT_CMP(ptr->left->max_end, ptr->max_end) > 0) {
+    ptr->max_end = ptr->left->max_end;
+  }
+  if (ptr->right && AVLT_CMP(ptr->right->max_end, ptr->max_end) > 0) {
+    ptr->max_end = ptr->right->max_end;
+  }
+#endif
+}
+
+int AVLT_FN(_tree_depth)(AVLT_TYPE* tree) {
+  if (tree->root) {
+    return tree->root->depth;
+  }
+  return 0;
+}
+
+#ifdef AVLT_INTERVAL
+int AVLT_FN(_overlaps)(AVLT_TYPE* tree, AVLT_KEY lo, AVLT_KEY hi,
+                       AVLT_FN(_interval_visitor_f) visitor) {
+  return AVLT_FN(_overlaps_helper)(tree->root, lo, hi, visitor);
+}
+
+static int AVLT_FN(_overlaps_helper)(AVLT_NODE* node, AVLT_KEY lo, AVLT_KEY hi,
+                                     AVLT_FN(_interval_visitor_f) visitor) {
+  int count;
+
+  /* every interval of the subtree ends before lo */
+  if (!node || AVLT_CMP(node->max_end, lo) < 0) {
+    return 0;
+  }
+
+  count = AVLT_FN(_overlaps_helper)(node->left, lo, hi, visitor);
+
+  /* this one and the right subtree start after hi */
+  if (AVLT_CMP(node->key, hi) > 0) {
+    return count;
+  }
+
+  if (AVLT_CMP(node->end, lo) >= 0) {
+    if (visitor) {
+      visitor(node->key, node->end, node->data);
+    }
+    count++;
+  }
+
+  return count + AVLT_FN(_overlaps_helper)(node->right, lo, hi, visitor);
+}
+#endif
+#endif /* AVLT_IMPLEMENTATION */
+
+#undef AVLT_END_PARAM
+#undef AVLT_END_ARG
+#undef AVLT_INTERVAL
+#undef AVLT_NODE
+#undef AVLT_FN
+#undef AVLT_TYPE
+#undef AVLT_PREFIX
+#undef AVLT_KEY
+#undef AVLT_CMP
+#undef AVLT_IMPLEMENTATION
@@ -0,0 +1,599 @@
+/*--------------------------------------------------------------------------*\
+ * B-tree implementation by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Ordered map with the same interface as structures/avl.h, but storing many
+ * keys per node. The key array of a node is sized to fill BTREE_KEY_LINES
+ * cache lines so that a lookup touches a couple of lines per level instead
+ * of one line per key. Leaves are allocated without the child array.
+ *
+ * Same key managment contract as avl.h:
+ * - user MUST allocate keys
+ * - user MUST NOT destroy key
+ * - bt_ MUST destroy keys when they are not needed anymore
+ *
+ * Integer keys: when the tree is initialized with a NULL comparator, keys
+ * are not pointers but unsigned integers stored in the pointer itself (use
+ * BTREE_INT_KEY to convert). The comparison is then inlined, no key has to
+ * be allocated and the destructor should be NULL.
+ *
+ * Documentation is just before each function in header part (just below).
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if BTREE_IMPLEMENTATION
+ * is defined.
+ * Jump to BTREE_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef BTREE_H
+#define BTREE_H
+
+/* memory allocation macros, change as necessary */
+#define BTREE_ALLOC(variable, size) variable = (BTreeNode *)malloc(size)
+#define BTREE_FREE(variable) free(variable)
+#include <stdlib.h> /* for malloc() */
+#include <stdint.h> /* for uintptr_t */
+
+/* node geometry, override before including if needed */
+#ifndef BTREE_CACHE_LINE
+#define BTREE_CACHE_LINE 64
+#endif
+#ifndef BTREE_KEY_LINES
+#define BTREE_KEY_LINES 2
+#endif
+
+/* minimum number of children of an internal node (except the root) */
+#define BTREE_MIN_DEGREE \
+  ((BTREE_KEY_LINES * BTREE_CACHE_LINE / sizeof(void *) + 1) / 2)
+#define BTREE_MAX_KEYS (2 * BTREE_MIN_DEGREE - 1)
+
+/* convert an unsigned integer to a key of a tree without comparator */
+#define BTREE_INT_KEY(i) ((void *)(uintptr_t)(i))
+
+typedef int (*bt_comparator_f)(const void* key1, const void* key2);
+typedef void (*bt_key_destructor_f)(void* key);
+typedef void (*bt_node_visitor_f)(const void* key, void* data);
+
+/* A leaf is only a BTreeNode, an internal node is a BTreeInnerNode */
+typedef struct BTreeNode {
+  /* keys come first so that they share the first cache lines with count */
+  void* keys[BTREE_MAX_KEYS];
+  int count;
+  int leaf;
+  void* data[BTREE_MAX_KEYS];
+} BTreeNode;
+
+typedef struct {
+  BTreeNode base;
+  BTreeNode* children[BTREE_MAX_KEYS + 1];
+} BTreeInnerNode;
+
+#define BTREE_CHILDREN(node) (((BTreeInnerNode *)(node))->children)
+
+typedef struct {
+  BTreeNode* root;
+  bt_comparator_f comparator;
+  bt_key_destructor_f destructor;
+} BTree;
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_initialize() - initialize a new tree
+ *  DESCRIPTION:
+ *      Initialize a tree. The user have to own the memory corresponding to the
+ *      tree. It should be cleand with bt_destroy.
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to initialize
+ *      comparator  - a bt_comparator_f function pointer ((void*, void*) -> int) to
+ *                    compare keys, or NULL for integer keys (see BTREE_INT_KEY)
+ *      destructor  - a bt_key_destructor_f function pointer (void* -> void) to
+ *                    destroy keys, or NULL if keys do not need to be destroyed
+\*--------------------------------------------------------------------------*/
+void bt_initialize(BTree* tree,
+                   bt_comparator_f comparator,
+                   bt_key_destructor_f destructor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_destroy() - destroy a tree
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to destroy
+ *      visitor     - a bt_node_visitor_f function pointer ((void *key, void *data) -> void)
+ *                    Applied on each key-value pair before destroying it. Use
+ *                    it for your own cleanup of the data.
+ *                    visitor should NOT free the key.
+ *                    Use NULL when you don't want the data to be freed.
+ *                    The tree will be freed anyway.
+\*--------------------------------------------------------------------------*/
+void bt_destroy(BTree* tree, bt_node_visitor_f visitor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_search() - search for a key and eventually return the data
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* bt_search(BTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_insert() - insert a key-value pair
+ *  DESCRIPTION:
+ *      If the key is already present, replace the value with the new data
+ *      and return a pointer to the old data.
+ *      Else insert the data and return NULL.
+ *      Anyway the key memory is no longer yours, it may be freed or used,
+ *      consider that you should forget about it.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* bt_insert(BTree* tree, void* key, void* data);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_remove() - remove a key-value pair
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, remove it from the tree and
+ *      return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* bt_remove(BTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_range() - visit a range of keys in order
+ *  DESCRIPTION:
+ *      Apply visitor on each key-value pair such that lo <= key <= hi, in
+ *      increasing key order. visitor should NOT free the key nor modify the
+ *      tree.
+ *  EFFICIENCY:
+ *      O(log(n) + k) where k is the number of visited pairs
+\*--------------------------------------------------------------------------*/
+void bt_range(BTree* tree, const void* lo, const void* hi,
+              bt_node_visitor_f visitor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      bt_tree_depth() - return the depth of the tree
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+int bt_tree_depth(BTree* tree);
+
+#endif
+
+#ifdef BTREE_IMPLEMENTATION
+#include <string.h> /* for memmove() */
+
+/* allocate an empty node */
+static BTreeNode* bt_new_node(int leaf);
+/* three way comparison of two keys, inlined for integer keys */
+static int bt_compare(BTree* tree, const void* key1, const void* key2);
+/* index of the first key of node not lower than key, set found if equal */
+static int bt_lower_bound(BTree* tree, BTreeNode* node,
+                          const void* key, int* found);
+/* recursive destruction helper */
+static void bt_destroy_helper(BTree* tree,
+                              BTreeNode* node, bt_node_visitor_f visitor);
+/* recursive range helper */
+static void bt_range_helper(BTree* tree, BTreeNode* node,
+                            const void* lo, const void* hi,
+                            bt_node_visitor_f visitor);
+/* split the full i-th child of node, node must not be full */
+static void bt_split_child(BTreeNode* node, int i);
+/* merge the i-th and (i+1)-th children of node with the i-th key */
+static void bt_merge(BTreeNode* node, int i);
+/* make sure the i-th child of node has more than the minimum number of
+ * keys, return the index of the child containing the same range of keys */
+static int bt_fill(BTreeNode* node, int i);
+/* remove and return the greatest (resp. lowest) pair of the subtree */
+static void bt_pop_max(BTreeNode* node, void** key, void** data);
+static void bt_pop_min(BTreeNode* node, void** key, void** data);
+/* remove the i-th pair of node without looking at the keys */
+static void bt_remove_at(BTreeNode* node, int i);
+
+void bt_initialize(BTree* tree, bt_comparator_f comparator,
+                   bt_key_destructor_f destructor) {
+
+  tree->comparator = comparator;
+  tree->destructor = destructor;
+  tree->root = NULL;
+}
+
+void bt_destroy(BTree* tree, bt_node_visitor_f visitor) {
+  bt_destroy_helper(tree, tree->root, visitor);
+  tree->root = NULL;
+}
+
+static void bt_destroy_helper(BTree* tree,
+                              BTreeNode* node, bt_node_visitor_f visitor) {
+  int i;
+
+  if (node == NULL) {
+    return;
+  }
+
+  for (i = 0; i < node->count; i++) {
+    if (visitor) {
+      visitor(node->keys[i], node->data[i]);
+    }
+    if (tree->destructor) {
+      tree->destructor(node->keys[i]);
+    }
+  }
+  if (!node->leaf) {
+    for (i = 0; i <= node->count; i++) {
+      bt_destroy_helper(tree, BTREE_CHILDREN(node)[i], visitor);
+    }
+  }
+
+  BTREE_FREE(node);
+}
+
+static BTreeNode* bt_new_node(int leaf) {
+  BTreeNode* node;
+  if (leaf) {
+    BTREE_ALLOC(node, sizeof(BTreeNode));
+  } else {
+    BTREE_ALLOC(node, sizeof(BTreeInnerNode));
+  }
+  node->count = 0;
+  node->leaf = leaf;
+  return node;
+}
+
+static int bt_compare(BTree* tree, const void* key1, const void* key2) {
+  uintptr_t val1, val2;
+  if (tree->comparator) {
+    return tree->comparator(key1, key2);
+  }
+  val1 = (uintptr_t)key1;
+  val2 = (uintptr_t)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+static int bt_lower_bound(BTree* tree, BTreeNode* node,
+                          const void* key, int* found) {
+  int lo = 0, hi = node->count, mid, cmp;
+
+  if (!tree->comparator) {
+    /* a linear scan of packed integers is cheaper than a binary search */
+    uintptr_t val = (uintptr_t)key;
+    while (lo < hi && (uintptr_t)node->keys[lo] < val) {
+      lo++;
+    }
+    *found = lo < hi && (uintptr_t)node->keys[lo] == val;
+    return lo;
+  }
+
+  *found = 0;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    cmp = tree->comparator(key, node->keys[mid]);
+    if (cmp == 0) {
+      *found = 1;
+      return mid;
+    } else if (cmp < 0) {
+      hi = mid;
+    } else {  /* if(cmp > 0) */
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+void* bt_search(BTree* tree, const void* key) {
+  BTreeNode* node = tree->root;
+  int i, found;
+  while (node) {
+    i = bt_lower_bound(tree, node, key, &found);
+    if (found) {
+      return node->data[i];
+    } else if (node->leaf) {
+      return NULL;
+    }
+    node = BTREE_CHILDREN(node)[i];
+  }
+  return NULL;
+}
+
+void* bt_insert(BTree* tree, void* key, void* data) {
+  BTreeNode* node = tree->root;
+  void* old;
+  int i, found, cmp;
+
+  if (!node) {
+    node = bt_new_node(1);
+    node->keys[0] = key;
+    node->data[0] = data;
+    node->count = 1;
+    tree->root = node;
+    return NULL;
+  }
+
+  /* full nodes are split on the way down, so that there is always room for
+   * the median key of a child in its parent. */
+  if (node->count == BTREE_MAX_KEYS) {
+    node = bt_new_node(0);
+    BTREE_CHILDREN(node)[0] = tree->root;
+    bt_split_child(node, 0);
+    tree->root = node;
+  }
+
+  for (;;) {
+    i = bt_lower_bound(tree, node, key, &found);
+    if (!found && !node->leaf
+        && BTREE_CHILDREN(node)[i]->count == BTREE_MAX_KEYS) {
+      bt_split_child(node, i);
+      /* the median of the child moved up at index i */
+      cmp = bt_compare(tree, key, node->keys[i]);
+      if (cmp == 0) {
+        found = 1;
+      } else if (cmp > 0) {
+        i++;
+      }
+    }
+
+    if (found) {
+      old = node->data[i];
+      node->data[i] = data;
+      /* we don't need the new key any more. */
+      if (tree->destructor) {
+        tree->destructor(key);
+      }
+      return old;
+    }
+
+    if (node->leaf) {
+      memmove(&node->keys[i + 1], &node->keys[i],
+              (node->count - i) * sizeof(void *));
+      memmove(&node->data[i + 1], &node->data[i],
+              (node->count - i) * sizeof(void *));
+      node->keys[i] = key;
+      node->data[i] = data;
+      node->count++;
+      return NULL;
+    }
+
+    node = BTREE_CHILDREN(node)[i];
+  }
+}
+
+static void bt_split_child(BTreeNode* node, int i) {
+  BTreeNode* child = BTREE_CHILDREN(node)[i];
+  BTreeNode* sibling = bt_new_node(child->leaf);
+  int t = BTREE_MIN_DEGREE;
+
+  /* upper half of child goes to the new sibling */
+  sibling->count = t - 1;
+  memcpy(sibling->keys, &child->keys[t], (t - 1) * sizeof(void *));
+  memcpy(sibling->data, &child->data[t], (t - 1) * sizeof(void *));
+  if (!child->leaf) {
+    memcpy(BTREE_CHILDREN(sibling), &BTREE_CHILDREN(child)[t],
+           t * sizeof(BTreeNode *));
+  }
+  child->count = t - 1;
+
+  /* median goes up in node */
+  memmove(&node->keys[i + 1], &node->keys[i],
+          (node->count - i) * sizeof(void *));
+  memmove(&node->data[i + 1], &node->data[i],
+          (node->count - i) * sizeof(void *));
+  memmove(&BTREE_CHILDREN(node)[i + 2], &BTREE_CHILDREN(node)[i + 1],
+          (node->count - i) * sizeof(BTreeNode *));
+  node->keys[i] = child->keys[t - 1];
+  node->data[i] = child->data[t - 1];
+  BTREE_CHILDREN(node)[i + 1] = sibling;
+  node->count++;
+}
+
+void* bt_remove(BTree* tree, const void* key) {
+  BTreeNode* node = tree->root;
+  void* ret = NULL;
+  int i, found;
+
+  /* every node we descend into is first filled above the minimum so that
+   * removing a key from it never requires to go back up. */
+  while (node) {
+    i = bt_lower_bound(tree, node, key, &found);
+    if (found) {
+      ret = node->data[i];
+      if (tree->destructor) {
+        tree->destructor(node->keys[i]);
+      }
+      bt_remove_at(node, i);
+      break;
+    } else if (node->leaf) {
+      break;
+    }
+    i = bt_fill(node, i);
+    node = BTREE_CHILDREN(node)[i];
+  }
+
+  /* the root may have been emptied by a merge */
+  node = tree->root;
+  if (node && node->count == 0) {
+    tree->root = node->leaf ? NULL : BTREE_CHILDREN(node)[0];
+    BTREE_FREE(node);
+  }
+
+  return ret;
+}
+
+static void bt_remove_at(BTreeNode* node, int i) {
+  int t = BTREE_MIN_DEGREE;
+  for (;;) {
+    if (node->leaf) {
+      memmove(&node->keys[i], &node->keys[i + 1],
+              (node->count - i - 1) * sizeof(void *));
+      memmove(&node->data[i], &node->data[i + 1],
+              (node->count - i - 1) * sizeof(void *));
+      node->count--;
+      return;
+    }
+
+    /* replace by predecessor or successor if one of them can be spared */
+    if (BTREE_CHILDREN(node)[i]->count >= t) {
+      bt_pop_max(BTREE_CHILDREN(node)[i], &node->keys[i], &node->data[i]);
+      return;
+    } else if (BTREE_CHILDREN(node)[i + 1]->count >= t) {
+      bt_pop_min(BTREE_CHILDREN(node)[i + 1], &node->keys[i], &node->data[i]);
+      return;
+    }
+
+    /* else push the pair down in the merge of both children */
+    bt_merge(node, i);
+    node = BTREE_CHILDREN(node)[i];
+    i = t - 1;
+  }
+}
+
+static void bt_pop_max(BTreeNode* node, void** key, void** data) {
+  int i;
+  while (!node->leaf) {
+    i = bt_fill(node, node->count);
+    node = BTREE_CHILDREN(node)[i];
+  }
+  node->count--;
+  *key = node->keys[node->count];
+  *data = node->data[node->count];
+}
+
+static void bt_pop_min(BTreeNode* node, void** key, void** data) {
+  while (!node->leaf) {
+    bt_fill(node, 0);
+    node = BTREE_CHILDREN(node)[0];
+  }
+  *key = node->keys[0];
+  *data = node->data[0];
+  node->count--;
+  memmove(&node->keys[0], &node->keys[1], node->count * sizeof(void *));
+  memmove(&node->data[0], &node->data[1], node->count * sizeof(void *));
+}
+
+static int bt_fill(BTreeNode* node, int i) {
+  BTreeNode* child = BTREE_CHILDREN(node)[i];
+  BTreeNode* sibling;
+  int t = BTREE_MIN_DEGREE;
+
+  if (child->count >= t) {
+    return i;
+  }
+
+  if (i > 0 && BTREE_CHILDREN(node)[i - 1]->count >= t) {
+    /* rotate the last pair of the left sibling through node */
+    sibling = BTREE_CHILDREN(node)[i - 1];
+    memmove(&child->keys[1], &child->keys[0], child->count * sizeof(void *));
+    memmove(&child->data[1], &child->data[0], child->count * sizeof(void *));
+    if (!child->leaf) {
+      memmove(&BTREE_CHILDREN(child)[1], &BTREE_CHILDREN(child)[0],
+              (child->count + 1) * sizeof(BTreeNode *));
+      BTREE_CHILDREN(child)[0] = BTREE_CHILDREN(sibling)[sibling->count];
+    }
+    child->keys[0] = node->keys[i - 1];
+    child->data[0] = node->data[i - 1];
+    child->count++;
+    sibling->count--;
+    node->keys[i - 1] = sibling->keys[sibling->count];
+    node->data[i - 1] = sibling->data[sibling->count];
+  } else if (i < node->count && BTREE_CHILDREN(node)[i + 1]->count >= t) {
+    /* rotate the first pair of the right sibling through node */
+    sibling = BTREE_CHILDREN(node)[i + 1];
+    child->keys[child->count] = node->keys[i];
+    child->data[child->count] = node->data[i];
+    if (!child->leaf) {
+      BTREE_CHILDREN(child)[child->count + 1] = BTREE_CHILDREN(sibling)[0];
+      memmove(&BTREE_CHILDREN(sibling)[0], &BTREE_CHILDREN(sibling)[1],
+              sibling->count * sizeof(BTreeNode *));
+    }
+    child->count++;
+    node->keys[i] = sibling->keys[0];
+    node->data[i] = sibling->data[0];
+    sibling->count--;
+    memmove(&sibling->keys[0], &sibling->keys[1],
+            sibling->count * sizeof(void *));
+    memmove(&sibling->data[0], &sibling->data[1],
+            sibling->count * sizeof(void *));
+  } else if (i < node->count) {
+    bt_merge(node, i);
+  } else {
+    bt_merge(node, i - 1);
+    i--;
+  }
+  return i;
+}
+
+static void bt_merge(BTreeNode* node, int i) {
+  BTreeNode* child = BTREE_CHILDREN(node)[i];
+  BTreeNode* sibling = BTREE_CHILDREN(node)[i + 1];
+
+  child->keys[child->count] = node->keys[i];
+  child->data[child->count] = node->data[i];
+  memcpy(&child->keys[child->count + 1], sibling->keys,
+         sibling->count * sizeof(void *));
+  memcpy(&child->data[child->count + 1], sibling->data,
+         sibling->count * sizeof(void *));
+  if (!child->leaf) {
+    memcpy(&BTREE_CHILDREN(child)[child->count + 1], BTREE_CHILDREN(sibling),
+           (sibling->count + 1) * sizeof(BTreeNode *));
+  }
+  child->count += sibling->count + 1;
+  BTREE_FREE(sibling);
+
+  memmove(&node->keys[i], &node->keys[i + 1],
+          (node->count - i - 1) * sizeof(void *));
+  memmove(&node->data[i], &node->data[i + 1],
+          (node->count - i - 1) * sizeof(void *));
+  memmove(&BTREE_CHILDREN(node)[i + 1], &BTREE_CHILDREN(node)[i + 2],
+          (node->count - i - 1) * sizeof(BTreeNode *));
+  node->count--;
+}
+
+void bt_range(BTree* tree, const void* lo, const void* hi,
+              bt_node_visitor_f visitor) {
+  if (tree->root) {
+    bt_range_helper(tree, tree->root, lo, hi, visitor);
+  }
+}
+
+static void bt_range_helper(BTree* tree, BTreeNode* node,
+                            const void* lo, const void* hi,
+                            bt_node_visitor_f visitor) {
+  int i, found;
+
+  i = bt_lower_bound(tree, node, lo, &found);
+  /* the subtree on the left of an exact match is entirely below lo */
+  if (!node->leaf && !found) {
+    bt_range_helper(tree, BTREE_CHILDREN(node)[i], lo, hi, visitor);
+  }
+  for (; i < node->count; i++) {
+    if (bt_compare(tree, node->keys[i], hi) > 0) {
+      return;
+    }
+    visitor(node->keys[i], node->data[i]);
+    if (!node->leaf) {
+      bt_range_helper(tree, BTREE_CHILDREN(node)[i + 1], lo, hi, visitor);
+    }
+  }
+}
+
+int bt_tree_depth(BTree* tree) {
+  BTreeNode* node = tree->root;
+  int depth = 0;
+  while (node) {
+    depth++;
+    node = node->leaf ? NULL : BTREE_CHILDREN(node)[0];
+  }
+  return depth;
+}
+#endif /* BTREE_IMPLEMENTATION */
@@ -0,0 +1,844 @@
+/*--------------------------------------------------------------------------*\
+ * Concurrent AVL tree by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Ordered map on the algorithms of structures/avl.h that can be used by any
+ * number of threads at the same time.
+ *
+ * Every node carries a version lock: a counter bumped by each modification
+ * of the node, with a lock bit and an obsolete bit (the node was unlinked).
+ * - cavl_search never writes to the tree. It reads each node optimistically
+ *   and validates, after reading a child pointer, that the version of the
+ *   node did not change, and after reading the version of a child, that
+ *   the parent did not change (lock coupling). It restarts from the root if
+ *   a validation fails.
+ * - cavl_insert and cavl_remove first descend the same way, then compute
+ *   from the recorded heights the exact set of nodes the rebalancing will
+ *   touch: the path up to the last node whose height does not change, and
+ *   the siblings taking part in rotations. Only these nodes are locked, by
+ *   upgrading the versions read during the descent, and the operation
+ *   restarts if one of them changed in the meantime. Writers on distinct
+ *   parts of the tree do not block each other.
+ *
+ * Since searches are optimistic, a node is never moved up the tree with a
+ * new key: removing a key from a node with two children only marks the
+ * node as deleted and it is kept to route searches. Such a node is unlinked
+ * when it loses one of its children, by a removal below it or by a
+ * rotation moving it down, and revived if its key is inserted again.
+ *
+ * Unlinked nodes may still be read by concurrent operations so they are
+ * only freed (and their key destroyed) by cavl_reclaim or cavl_destroy,
+ * which must be called while no other operation is running on the tree.
+ *
+ * Same key managment contract as avl.h:
+ * - user MUST allocate keys
+ * - user MUST NOT destroy key
+ * - cavl_ MUST destroy keys when they are not needed anymore
+ *
+ * Data returned by cavl_insert and cavl_remove may still be read by a
+ * concurrent cavl_search.
+ *
+ * Requires C11 atomics and sched_yield.
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if CAVL_IMPLEMENTATION
+ * is defined.
+ * Jump to CAVL_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef CAVL_H
+#define CAVL_H
+
+/* memory allocation macros, change as necessary */
+#define CAVL_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define CAVL_FREE(variable) free(variable)
+#include <stdlib.h> /* for malloc() */
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* longest path from the root, an AVL tree of this height holds more than
+ * 2^40 keys */
+#ifndef CAVL_MAX_DEPTH
+#define CAVL_MAX_DEPTH 64
+#endif
+
+typedef int (*cavl_comparator_f)(const void* key1, const void* key2);
+typedef void (*cavl_key_destructor_f)(void* key);
+typedef void (*cavl_node_visitor_f)(const void* key, void* data);
+
+#define CAVL_LEFT 0
+#define CAVL_RIGHT 1
+
+typedef struct CavlNode {
+  atomic_uint_fast64_t version;
+  _Atomic(struct CavlNode*) child[2];
+  atomic_int depth;
+  atomic_int deleted;
+
+  void* key;
+  _Atomic(void*) data;
+
+  /* link in the list of unlinked nodes waiting to be freed */
+  struct CavlNode* retired;
+} CavlNode;
+
+typedef struct {
+  /* the root is the right child of this node, so that it can be locked as
+   * any other parent */
+  CavlNode holder;
+  cavl_comparator_f comparator;
+  cavl_key_destructor_f destructor;
+  _Atomic(CavlNode*) retired;
+} CavlTree;
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_initialize() - initialize a new tree
+ *  DESCRIPTION:
+ *      Initialize a tree. The user have to own the memory corresponding to the
+ *      tree. It should be cleand with cavl_destroy.
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to initialize
+ *      comparator  - a cavl_comparator_f function pointer ((void*, void*) -> int) to
+ *                    compare keys
+ *      destructor  - a cavl_key_destructor_f function pointer (void* -> void) to
+ *                    destroy keys
+\*--------------------------------------------------------------------------*/
+void cavl_initialize(CavlTree* tree,
+                     cavl_comparator_f comparator,
+                     cavl_key_destructor_f destructor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_destroy() - destroy a tree
+ *  DESCRIPTION:
+ *      No other operation may be running on the tree.
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to destroy
+ *      visitor     - a cavl_node_visitor_f function pointer ((void *key, void *data) -> void)
+ *                    Applied on each key-value pair before destroying it. Use
+ *                    it for your own cleanup of the data.
+ *                    visitor should NOT free the key.
+ *                    Use NULL when you don't want the data to be freed.
+ *                    The tree will be freed anyway.
+\*--------------------------------------------------------------------------*/
+void cavl_destroy(CavlTree* tree, cavl_node_visitor_f visitor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_search() - search for a key and eventually return the data
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *      Never takes a lock.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* cavl_search(CavlTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_insert() - insert a key-value pair
+ *  DESCRIPTION:
+ *      If the key is already present, replace the value with the new data
+ *      and return a pointer to the old data.
+ *      Else insert the data and return NULL.
+ *      Anyway the key memory is no longer yours, it may be freed or used,
+ *      consider that you should forget about it.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* cavl_insert(CavlTree* tree, void* key, void* data);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_remove() - remove a key-value pair
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, remove it from the tree and
+ *      return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* cavl_remove(CavlTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_reclaim() - free the unlinked nodes
+ *  DESCRIPTION:
+ *      Free the nodes removed since the last call and destroy their keys.
+ *      No other operation may be running on the tree.
+ *  EFFICIENCY:
+ *      O(k) where k is the number of nodes to free
+\*--------------------------------------------------------------------------*/
+void cavl_reclaim(CavlTree* tree);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      cavl_tree_depth() - return the depth of the tree
+ *  EFFICIENCY:
+ *      O(1)
+\*--------------------------------------------------------------------------*/
+int cavl_tree_depth(CavlTree* tree);
+
+#endif
+
+#ifdef CAVL_IMPLEMENTATION
+#include <sched.h> /* for sched_yield() */
+
+/* version word: lock bit, obsolete bit, then a modification counter */
+#define CAVL_LOCKED 1u
+#define CAVL_OBSOLETE 2u
+#define CAVL_STEP 4u
+
+/* spins on a locked node before yielding the processor */
+#define CAVL_SPINS 128
+
+/* nodes visited by an optimistic descent, nodes[0] is the holder */
+typedef struct {
+  int len;
+  CavlNode* nodes[CAVL_MAX_DEPTH + 1];
+  uint_fast64_t versions[CAVL_MAX_DEPTH + 1];
+  /* direction taken from each node */
+  int dirs[CAVL_MAX_DEPTH + 1];
+} CavlPath;
+
+/* nodes locked by a modification, the path and two nodes per rotation */
+#define CAVL_MAX_REGION (3 * CAVL_MAX_DEPTH + 2)
+#define CAVL_UNCHANGED 0
+#define CAVL_MODIFIED 1
+#define CAVL_UNLINKED 2
+typedef struct {
+  int count;
+  CavlNode* nodes[CAVL_MAX_REGION];
+  uint_fast64_t versions[CAVL_MAX_REGION];
+  int states[CAVL_MAX_REGION];
+} CavlRegion;
+
+/* routing nodes left with less than two children by the rotations of a
+ * modification, at most two rotations per node of the path */
+typedef struct {
+  int count;
+  CavlNode* nodes[2 * CAVL_MAX_DEPTH];
+} CavlMoved;
+
+/* wait for the node to be unlocked and return its version */
+static uint_fast64_t cavl_stable_version(CavlNode* node);
+/* check that the node did not change since version was read */
+static int cavl_validate(CavlNode* node, uint_fast64_t version);
+/* lock the node if it is still at version */
+static int cavl_try_lock(CavlNode* node, uint_fast64_t version);
+/* unlock the node, bumping its version if state is not CAVL_UNCHANGED */
+static void cavl_unlock(CavlNode* node, int state);
+/* add a node to lock to a region */
+static void cavl_region_add(CavlRegion* region, CavlNode* node,
+                            uint_fast64_t version, int state);
+/* lock every node of a region or none */
+static int cavl_region_lock(CavlRegion* region);
+static void cavl_region_unlock(CavlRegion* region);
+
+/* optimistic descent toward key, return -1 if it must be restarted, 1 if
+ * the last node of the path holds key, 0 if the path ends on the parent of
+ * the empty slot where key would be */
+static int cavl_descend(CavlTree* tree, const void* key, CavlPath* path);
+/* single attempts of the modifications, return 0 to restart */
+static int cavl_insert_attempt(CavlTree* tree, CavlNode* leaf, void** ret,
+                               CavlMoved* moved);
+static int cavl_remove_attempt(CavlTree* tree, const void* key, int routing,
+                               void** ret, CavlNode** parent,
+                               CavlMoved* moved);
+/* unlink a node and its ancestors as long as they only route searches */
+static void cavl_cleanup(CavlTree* tree, CavlNode* node);
+/* cavl_cleanup on the nodes moved down by a modification */
+static void cavl_cleanup_moved(CavlTree* tree, CavlMoved* moved);
+/* recursive destruction helper */
+static void cavl_destroy_helper(CavlTree* tree,
+                                CavlNode* node, cavl_node_visitor_f visitor);
+
+/* accessors, consistency is checked with versions but child pointers
+ * publish the nodes they point to */
+static CavlNode* cavl_child(CavlNode* node, int dir);
+static void cavl_set_child(CavlNode* node, int dir, CavlNode* child);
+static int cavl_depth(CavlNode* node);
+
+/* the following work on locked nodes */
+/* rotates a node and its left/right child as appropriate (left=0, right=1),
+ * node is added to moved if it is a routing node losing a child */
+static void cavl_rotate(CavlNode* parent, int pdir, CavlNode* node, int dir,
+                        CavlMoved* moved);
+/* performs rotations to appropriately rebalance a node and its children */
+static void cavl_rebalance(CavlNode* parent, int pdir, CavlNode* node,
+                           CavlMoved* moved);
+/* calculates how out-of-balance a node is (>0 if left deeper) */
+static int cavl_balance_factor(CavlNode* ptr);
+/* recalculates the depth of a node */
+static void cavl_update_depth(CavlNode* ptr);
+
+void cavl_initialize(CavlTree* tree, cavl_comparator_f comparator,
+                     cavl_key_destructor_f destructor) {
+
+  tree->comparator = comparator;
+  tree->destructor = destructor;
+  atomic_init(&tree->holder.version, 0);
+  atomic_init(&tree->holder.child[CAVL_LEFT], NULL);
+  atomic_init(&tree->holder.child[CAVL_RIGHT], NULL);
+  atomic_init(&tree->holder.depth, 0);
+  atomic_init(&tree->holder.deleted, 0);
+  atomic_init(&tree->holder.data, NULL);
+  tree->holder.key = NULL;
+  atomic_init(&tree->retired, NULL);
+}
+
+void cavl_destroy(CavlTree* tree, cavl_node_visitor_f visitor) {
+  cavl_destroy_helper(tree, cavl_child(&tree->holder, CAVL_RIGHT), visitor);
+  cavl_set_child(&tree->holder, CAVL_RIGHT, NULL);
+  cavl_reclaim(tree);
+}
+
+static void cavl_destroy_helper(CavlTree* tree,
+                                CavlNode* node, cavl_node_visitor_f visitor) {
+
+  if (node == NULL) {
+    return;
+  }
+
+  if (visitor && !atomic_load(&node->deleted)) {
+    visitor(node->key, atomic_load(&node->data));
+  }
+  if (tree->destructor) {
+    tree->destructor(node->key);
+  }
+  cavl_destroy_helper(tree, cavl_child(node, CAVL_LEFT), visitor);
+  cavl_destroy_helper(tree, cavl_child(node, CAVL_RIGHT), visitor);
+
+  CAVL_FREE(node);
+}
+
+void cavl_reclaim(CavlTree* tree) {
+  CavlNode* node = atomic_exchange(&tree->retired, NULL);
+  CavlNode* next;
+  while (node) {
+    next = node->retired;
+    if (tree->destructor) {
+      tree->destructor(node->key);
+    }
+    CAVL_FREE(node);
+    node = next;
+  }
+}
+
+static uint_fast64_t cavl_stable_version(CavlNode* node) {
+  uint_fast64_t version;
+  int spins = 0;
+  for (;;) {
+    version = atomic_load_explicit(&node->version, memory_order_acquire);
+    if (!(version & CAVL_LOCKED)) {
+      return version;
+    }
+    if (++spins == CAVL_SPINS) {
+      /* the writer may have been preempted */
+      spins = 0;
+      sched_yield();
+    }
+  }
+}
+
+static int cavl_validate(CavlNode* node, uint_fast64_t version) {
+  /* order the optimistic reads before the check */
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&node->version, memory_order_relaxed)
+         == version;
+}
+
+static int cavl_try_lock(CavlNode* node, uint_fast64_t version) {
+  if (version & (CAVL_LOCKED | CAVL_OBSOLETE)) {
+    return 0;
+  }
+  if (!atomic_compare_exchange_strong_explicit(
+        &node->version, &version, version | CAVL_LOCKED,
+        memory_order_acquire, memory_order_relaxed)) {
+    return 0;
+  }
+  /* order the lock before the following modifications */
+  atomic_thread_fence(memory_order_release);
+  return 1;
+}
+
+static void cavl_unlock(CavlNode* node, int state) {
+  uint_fast64_t version =
+    atomic_load_explicit(&node->version, memory_order_relaxed) & ~CAVL_LOCKED;
+  if (state != CAVL_UNCHANGED) {
+    version += CAVL_STEP;
+  }
+  if (state == CAVL_UNLINKED) {
+    version |= CAVL_OBSOLETE;
+  }
+  atomic_store_explicit(&node->version, version, memory_order_release);
+}
+
+static void cavl_region_add(CavlRegion* region, CavlNode* node,
+                            uint_fast64_t version, int state) {
+  region->nodes[region->count] = node;
+  region->versions[region->count] = version;
+  region->states[region->count] = state;
+  region->count++;
+}
+
+static int cavl_region_lock(CavlRegion* region) {
+  int i, j;
+  /* never wait for a lock, so that the order does not matter */
+  for (i = 0; i < region->count; i++) {
+    if (!cavl_try_lock(region->nodes[i], region->versions[i])) {
+      for (j = 0; j < i; j++) {
+        cavl_unlock(region->nodes[j], CAVL_UNCHANGED);
+      }
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void cavl_region_unlock(CavlRegion* region) {
+  int i;
+  for (i = 0; i < region->count; i++) {
+    cavl_unlock(region->nodes[i], region->states[i]);
+  }
+}
+
+static CavlNode* cavl_child(CavlNode* node, int dir) {
+  return atomic_load_explicit(&node->child[dir], memory_order_acquire);
+}
+
+static void cavl_set_child(CavlNode* node, int dir, CavlNode* child) {
+  atomic_store_explicit(&node->child[dir], child, memory_order_release);
+}
+
+static int cavl_depth(CavlNode* node) {
+  if (!node) {
+    return 0;
+  }
+  return atomic_load_explicit(&node->depth, memory_order_relaxed);
+}
+
+void* cavl_search(CavlTree* tree, const void* key) {
+  CavlNode* parent,* node,* next;
+  uint_fast64_t pversion, version;
+  void* data;
+  int cmp, deleted;
+
+restart:
+  parent = &tree->holder;
+  pversion = cavl_stable_version(parent);
+  node = cavl_child(parent, CAVL_RIGHT);
+  if (!cavl_validate(parent, pversion)) {
+    goto restart;
+  }
+
+  while (node) {
+    version = cavl_stable_version(node);
+    /* node was still the child of parent when its version was read */
+    if ((version & CAVL_OBSOLETE) || !cavl_validate(parent, pversion)) {
+      goto restart;
+    }
+
+    cmp = tree->comparator(key, node->key);
+    if (cmp == 0) {
+      data = atomic_load_explicit(&node->data, memory_order_relaxed);
+      deleted = atomic_load_explicit(&node->deleted, memory_order_relaxed);
+      if (!cavl_validate(node, version)) {
+        goto restart;
+      }
+      return deleted ? NULL : data;
+    }
+
+    next = cavl_child(node, cmp < 0 ? CAVL_LEFT : CAVL_RIGHT);
+    if (!cavl_validate(node, version)) {
+      goto restart;
+    }
+    parent = node;
+    pversion = version;
+    node = next;
+  }
+  return NULL;
+}
+
+static int cavl_descend(CavlTree* tree, const void* key, CavlPath* path) {
+  CavlNode* node,* next;
+  uint_fast64_t version;
+  int cmp, dir;
+
+  path->len = 1;
+  path->nodes[0] = &tree->holder;
+  path->versions[0] = cavl_stable_version(&tree->holder);
+  path->dirs[0] = CAVL_RIGHT;
+  node = cavl_child(&tree->holder, CAVL_RIGHT);
+  if (!cavl_validate(&tree->holder, path->versions[0])) {
+    return -1;
+  }
+
+  while (node) {
+    version = cavl_stable_version(node);
+    if ((version & CAVL_OBSOLETE)
+        || !cavl_validate(path->nodes[path->len - 1],
+                          path->versions[path->len - 1])
+        || path->len > CAVL_MAX_DEPTH) {
+      return -1;
+    }
+
+    path->nodes[path->len] = node;
+    path->versions[path->len] = version;
+    cmp = tree->comparator(key, node->key);
+    if (cmp == 0) {
+      path->len++;
+      return 1;
+    }
+    dir = cmp < 0 ? CAVL_LEFT : CAVL_RIGHT;
+    path->dirs[path->len] = dir;
+    path->len++;
+
+    next = cavl_child(node, dir);
+    if (!cavl_validate(node, version)) {
+      return -1;
+    }
+    node = next;
+  }
+  return 0;
+}
+
+void* cavl_insert(CavlTree* tree, void* key, void* data) {
+  CavlNode* leaf;
+  CavlMoved moved;
+  void* ret = NULL;
+
+  /* the node is ready before being linked so that searches never see it
+   * partially initialized */
+  CAVL_ALLOC(leaf, CavlNode);
+  atomic_init(&leaf->version, 0);
+  atomic_init(&leaf->child[CAVL_LEFT], NULL);
+  atomic_init(&leaf->child[CAVL_RIGHT], NULL);
+  atomic_init(&leaf->depth, 1);
+  atomic_init(&leaf->deleted, 0);
+  atomic_init(&leaf->data, data);
+  leaf->key = key;
+  leaf->retired = NULL;
+
+  while (!cavl_insert_attempt(tree, leaf, &ret, &moved)) {
+  }
+  cavl_cleanup_moved(tree, &moved);
+  return ret;
+}
+
+static int cavl_insert_attempt(CavlTree* tree, CavlNode* leaf, void** ret,
+                               CavlMoved* moved) {
+  CavlPath path;
+  CavlRegion region;
+  CavlNode* node;
+  int found, s, i, balance, rotate;
+
+  moved->count = 0;
+  found = cavl_descend(tree, leaf->key, &path);
+  if (found < 0) {
+    return 0;
+  }
+
+  region.count = 0;
+  if (found) {
+    /* replace the data, or revive a deleted node */
+    node = path.nodes[path.len - 1];
+    cavl_region_add(&region, node, path.versions[path.len - 1],
+                    CAVL_MODIFIED);
+    if (!cavl_region_lock(&region)) {
+      return 0;
+    }
+    *ret = atomic_load_explicit(&node->deleted, memory_order_relaxed)
+           ? NULL : atomic_load_explicit(&node->data, memory_order_relaxed);
+    atomic_store_explicit(&node->data, atomic_load(&leaf->data),
+                          memory_order_relaxed);
+    atomic_store_explicit(&node->deleted, 0, memory_order_relaxed);
+    cavl_region_unlock(&region);
+
+    /* we don't need the new key any more. */
+    if (tree->destructor) {
+      tree->destructor(leaf->key);
+    }
+    CAVL_FREE(leaf);
+    return 1;
+  }
+
+  /* the height of every node below the deepest unbalanced node of the path
+   * grows by one, that node is either balanced or rotated, and nothing
+   * changes above it. */
+  s = path.len - 1;
+  while (s > 1 && cavl_balance_factor(path.nodes[s]) == 0) {
+    s--;
+  }
+
+  if (s > 0) {
+    balance = cavl_balance_factor(path.nodes[s]);
+    rotate = (balance > 0 && path.dirs[s] == CAVL_LEFT)
+             || (balance < 0 && path.dirs[s] == CAVL_RIGHT);
+    cavl_region_add(&region, path.nodes[s - 1], path.versions[s - 1],
+                    rotate ? CAVL_MODIFIED : CAVL_UNCHANGED);
+  }
+  for (i = s; i < path.len; i++) {
+    cavl_region_add(&region, path.nodes[i], path.versions[i], CAVL_MODIFIED);
+  }
+  /* not yet visible, it will be unlocked with the others */
+  cavl_region_add(&region, leaf, 0, CAVL_MODIFIED);
+
+  if (!cavl_region_lock(&region)) {
+    return 0;
+  }
+
+  cavl_set_child(path.nodes[path.len - 1], path.dirs[path.len - 1], leaf);
+  for (i = path.len - 1; i >= s && i > 0; i--) {
+    cavl_update_depth(path.nodes[i]);
+    cavl_rebalance(path.nodes[i - 1], path.dirs[i - 1], path.nodes[i],
+                   moved);
+  }
+
+  cavl_region_unlock(&region);
+  *ret = NULL;
+  return 1;
+}
+
+void* cavl_remove(CavlTree* tree, const void* key) {
+  CavlNode* parent;
+  CavlMoved moved;
+  void* ret;
+
+  while (!cavl_remove_attempt(tree, key, 0, &ret, &parent, &moved)) {
+  }
+  cavl_cleanup(tree, parent);
+  cavl_cleanup_moved(tree, &moved);
+  return ret;
+}
+
+static void cavl_cleanup_moved(CavlTree* tree, CavlMoved* moved) {
+  int i;
+  for (i = 0; i < moved->count; i++) {
+    cavl_cleanup(tree, moved->nodes[i]);
+  }
+}
+
+static void cavl_cleanup(CavlTree* tree, CavlNode* node) {
+  CavlNode* parent;
+  CavlMoved moved;
+  uint_fast64_t version;
+  int deleted, children;
+  void* ret;
+
+  while (node) {
+    version = cavl_stable_version(node);
+    deleted = atomic_load_explicit(&node->deleted, memory_order_relaxed);
+    children = (cavl_child(node, CAVL_LEFT) != NULL)
+               + (cavl_child(node, CAVL_RIGHT) != NULL);
+    if (!cavl_validate(node, version)) {
+      continue;
+    }
+    if (!deleted || children == 2 || (version & CAVL_OBSOLETE)) {
+      return;
+    }
+    /* the key of a node is valid until it is reclaimed */
+    while (!cavl_remove_attempt(tree, node->key, 1, &ret, &parent,
+                                &moved)) {
+    }
+    /* the rebalancing may move other routing nodes down */
+    cavl_cleanup_moved(tree, &moved);
+    node = parent;
+  }
+}
+
+static int cavl_remove_attempt(CavlTree* tree, const void* key, int routing,
+                               void** ret, CavlNode** parent,
+                               CavlMoved* moved) {
+  CavlPath path;
+  CavlRegion region;
+  CavlNode* node,* child,* a,* sibling,* inner;
+  uint_fast64_t version;
+  int found, d, i, stop, side, h, ho, hi, old, deleted, two_children;
+
+  *ret = NULL;
+  *parent = NULL;
+  moved->count = 0;
+
+  found = cavl_descend(tree, key, &path);
+  if (found < 0) {
+    return 0;
+  } else if (!found) {
+    return 1;
+  }
+
+  d = path.len - 1;
+  node = path.nodes[d];
+  deleted = atomic_load_explicit(&node->deleted, memory_order_relaxed);
+  child = cavl_child(node, CAVL_LEFT);
+  two_children = child && cavl_child(node, CAVL_RIGHT);
+  if (!child) {
+    child = cavl_child(node, CAVL_RIGHT);
+  }
+  if (!cavl_validate(node, path.versions[d])) {
+    return 0;
+  }
+
+  /* a routing node may only be unlinked, a live node only removed once */
+  if (deleted != routing || (routing && two_children)) {
+    return 1;
+  }
+
+  region.count = 0;
+  if (two_children) {
+    /* keep the node to route searches */
+    cavl_region_add(&region, node, path.versions[d], CAVL_MODIFIED);
+    if (!cavl_region_lock(&region)) {
+      return 0;
+    }
+    *ret = atomic_load_explicit(&node->data, memory_order_relaxed);
+    atomic_store_explicit(&node->data, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->deleted, 1, memory_order_relaxed);
+    cavl_region_unlock(&region);
+    return 1;
+  }
+
+  /* node is replaced by its only child, if any */
+  cavl_region_add(&region, node, path.versions[d], CAVL_UNLINKED);
+  cavl_region_add(&region, path.nodes[d - 1], path.versions[d - 1],
+                  CAVL_MODIFIED);
+
+  /* walk up while the height of the subtree decreases, to find the last
+   * node modified by the rebalancing, and the siblings to rotate on the
+   * way. Same decisions as cavl_rebalance on the same heights. */
+  h = cavl_depth(child);
+  for (i = d - 1; i > 0; i--) {
+    a = path.nodes[i];
+    side = path.dirs[i];
+    sibling = cavl_child(a, !side);
+    ho = cavl_depth(sibling);
+    old = cavl_depth(a);
+
+    if (ho - h < 2) {
+      /* no rotation */
+      if (1 + (ho > h ? ho : h) == old) {
+        break;
+      }
+      h = old - 1;
+      if (i > 1) {
+        cavl_region_add(&region, path.nodes[i - 1], path.versions[i - 1],
+                        CAVL_MODIFIED);
+      }
+      continue;
+    }
+
+    /* the sibling moves up */
+    version = cavl_stable_version(sibling);
+    inner = cavl_child(sibling, side);
+    hi = cavl_depth(inner);
+    ho = cavl_depth(cavl_child(sibling, !side));
+    if (!cavl_validate(sibling, version)) {
+      return 0;
+    }
+    cavl_region_add(&region, sibling, version, CAVL_MODIFIED);
+    if (hi > ho) {
+      /* double rotation, the inner child of the sibling moves up */
+      cavl_region_add(&region, inner, cavl_stable_version(inner),
+                      CAVL_MODIFIED);
+    }
+    cavl_region_add(&region, path.nodes[i - 1], path.versions[i - 1],
+                    CAVL_MODIFIED);
+    if (hi == ho) {
+      /* single rotation keeping the height */
+      break;
+    }
+    h = old - 1;
+  }
+  stop = i > 0 ? i : 1;
+
+  if (!cavl_region_lock(&region)) {
+    return 0;
+  }
+
+  cavl_set_child(path.nodes[d - 1], path.dirs[d - 1], child);
+  for (i = d - 1; i >= stop; i--) {
+    cavl_update_depth(path.nodes[i]);
+    cavl_rebalance(path.nodes[i - 1], path.dirs[i - 1], path.nodes[i],
+                   moved);
+  }
+  *ret = atomic_load_explicit(&node->data, memory_order_relaxed);
+
+  cavl_region_unlock(&region);
+
+  /* concurrent operations may still be reading it */
+  node->retired = atomic_load(&tree->retired);
+  while (!atomic_compare_exchange_weak(&tree->retired, &node->retired,
+                                       node)) {
+  }
+
+  if (d > 1) {
+    *parent = path.nodes[d - 1];
+  }
+  if (routing) {
+    *ret = NULL;
+  }
+  return 1;
+}
+
+static void cavl_rebalance(CavlNode* parent, int pdir, CavlNode* node,
+                           CavlMoved* moved) {
+  int delta = cavl_balance_factor(node);
+
+  /* two rotation directions */
+  if (delta == 2) {
+    if (cavl_balance_factor(cavl_child(node, CAVL_LEFT)) < 0) {
+      cavl_rotate(node, CAVL_LEFT, cavl_child(node, CAVL_LEFT), CAVL_LEFT,
+                  moved);
+    }
+    cavl_rotate(parent, pdir, node, CAVL_RIGHT, moved);
+  } else if (delta == -2) {
+    if (cavl_balance_factor(cavl_child(node, CAVL_RIGHT)) > 0) {
+      cavl_rotate(node, CAVL_RIGHT, cavl_child(node, CAVL_RIGHT), CAVL_RIGHT,
+                  moved);
+    }
+    cavl_rotate(parent, pdir, node, CAVL_LEFT, moved);
+  }
+}
+
+static void cavl_rotate(CavlNode* parent, int pdir, CavlNode* node, int dir,
+                        CavlMoved* moved) {
+  /* standard tree rotations, the child opposite to dir moves up */
+  CavlNode* ch = cavl_child(node, !dir);
+
+  cavl_set_child(node, !dir, cavl_child(ch, dir));
+  cavl_set_child(ch, dir, node);
+  cavl_update_depth(node);
+  cavl_update_depth(ch);
+  cavl_set_child(parent, pdir, ch);
+
+  /* node took the inner child of ch, which may be empty, it is unlinked by
+   * the caller once the region is unlocked */
+  if (atomic_load_explicit(&node->deleted, memory_order_relaxed)
+      && !(cavl_child(node, !dir) && cavl_child(node, dir))) {
+    moved->nodes[moved->count++] = node;
+  }
+}
+
+static int cavl_balance_factor(CavlNode* ptr) {
+  return cavl_depth(cavl_child(ptr, CAVL_LEFT))
+         - cavl_depth(cavl_child(ptr, CAVL_RIGHT));
+}
+
+static void cavl_update_depth(CavlNode* ptr) {
+  int l = cavl_depth(cavl_child(ptr, CAVL_LEFT));
+  int r = cavl_depth(cavl_child(ptr, CAVL_RIGHT));
+  atomic_store_explicit(&ptr->depth, 1 + (l > r ? l : r),
+                        memory_order_relaxed);
+}
+
+int cavl_tree_depth(CavlTree* tree) {
+  return cavl_depth(cavl_child(&tree->holder, CAVL_RIGHT));
+}
+#endif /* CAVL_IMPLEMENTATION */
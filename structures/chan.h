@@ -3,10 +3,25 @@
  *
  * Lock-less single-producer single-consumer channel.
  * Warning: Operations are only thread-safe if there is only one producer
- * thread and one consumer thread.
+ * thread and one consumer thread. The mpsc and mpmc variants at the end
+ * accept several producers (and consumers).
+ *
+ * The nodes are a ring buffer whose capacity is a power of two. The producer
+ * owns the tail index and the consumer owns the head index, both run freely
+ * and are masked on access. Each index is published with a release store
+ * and read with an acquire load by the other side, which makes the node
+ * written before the publication visible. The indices sit on separate cache
+ * lines, each with the copy of the opposite index last seen by its owner, so
+ * that the other index is only read again when the ring looks full (or
+ * empty) according to that copy.
  *
  * 2021 Mar 26, by Théo Cavignac (theo.cavignac@gmail.com)
  *
+ * Blocking calls spin for a while, then sleep on a futex on Linux. The
+ * implementation needs the POSIX and Linux definitions, define
+ * _DEFAULT_SOURCE (or _GNU_SOURCE) before any include when compiling with
+ * -std=c11.
+ *
  * By default this file is only a header.
  * The implementation of functions is added only if CHAN_IMPL is defined.
  * Jump to CHAN_IMPL to go to the start of implementation.
@@ -14,12 +29,37 @@
 #ifndef CHAN_H
 #define CHAN_H
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#define CHAN_CACHE_LINE 64
+/* smallest byte channel */
+#define BCHAN_MIN_SIZE 64
+/* spins of a blocking call before sleeping, adapted between these bounds */
+#define CHAN_MIN_SPINS 64
+#define CHAN_MAX_SPINS 16384
+/* shared memory channels */
+#define CHAN_SHM_MAGIC 0x6d68736e61686362 /* "bchanshm" */
+#define CHAN_SHM_VERSION 1
+#define CHAN_SHM_OFFSET CHAN_CACHE_LINE
+/* longest sleep between two checks of the channel */
+#define CHAN_PARK_NS 1000000000
+/* same when the wake up may be missed, without membarrier */
+#define CHAN_PARK_SLICE_NS 1000000
 
 typedef struct chan_state chan_state;
 
+/* Create a channel holding at least max_nodes pieces of data, the capacity
+ * is rounded up to a power of two.
+ * Return NULL if allocation failed.
+ */
 chan_state* chan_new_state(size_t max_nodes);
+/* Return another handle on the same channel, for the other thread */
 chan_state* chan_share_state(chan_state* s);
+/* Release a handle, the channel is freed with the last one */
 void chan_free(chan_state* s);
 
 /* Push a piece of data onto the channel if
@@ -34,89 +74,1256 @@ bool chan_push(chan_state* s, void* data);
  */
 bool chan_pop(chan_state* s, void** data);
 
+/* Push up to n pieces of data from data[0] to data[n - 1], with a single
+ * publication, and return the number pushed.
+ */
+size_t chan_push_n(chan_state* s, void** data, size_t n);
+
+/* Pop up to n pieces of data into data[0] to data[n - 1], with a single
+ * publication, and return the number popped.
+ */
+size_t chan_pop_n(chan_state* s, void** data, size_t n);
+
+/* Zero-copy access: reserve and peek give direct access to up to n
+ * consecutive nodes and return their number, which may be less than n
+ * (and 0) because the channel is full (or empty) or because the nodes stop
+ * at the end of the ring.
+ *
+ * The producer fills (*nodes)[0] to (*nodes)[k - 1] of a reservation, then
+ * makes the first k of them visible with chan_commit.
+ * The consumer reads (*nodes)[0] to (*nodes)[k - 1] of a peek, then gives
+ * the first k of them back with chan_release.
+ */
+size_t chan_reserve(chan_state* s, void*** nodes, size_t n);
+void chan_commit(chan_state* s, size_t k);
+size_t chan_peek(chan_state* s, void*** nodes, size_t n);
+void chan_release(chan_state* s, size_t k);
+
+/* Blocking versions of chan_push and chan_pop: when the channel is full (or
+ * empty) spin for a while, then sleep until the other side makes room (or
+ * sends data) or until timeout_ns nanoseconds passed. A negative timeout
+ * waits forever. Return false on timeout.
+ * The sleeping side is woken up by any operation of the other side, which
+ * only checks a flag as long as nobody sleeps.
+ */
+bool chan_push_wait(chan_state* s, void* data, int64_t timeout_ns);
+bool chan_pop_wait(chan_state* s, void** data, int64_t timeout_ns);
+
+/* Byte channel: same single-producer single-consumer ring, carrying
+ * variable-size messages copied inline instead of pointers. Each message is
+ * stored after a size_t length header, padded to 8 bytes, and never wraps:
+ * a padding record fills the end of the ring when needed. A message of len
+ * bytes always fits an empty channel of at least 2 * (len + 16) bytes.
+ */
+typedef struct bchan_state bchan_state;
+
+/* Create a byte channel of at least size bytes, rounded up to a power of
+ * two, return NULL if allocation failed */
+bchan_state* bchan_new_state(size_t size);
+bchan_state* bchan_share_state(bchan_state* s);
+void bchan_free(bchan_state* s);
+
+/* Return a buffer of len bytes to write a message to, or NULL if there is
+ * not enough room. The message is sent by bchan_commit, with a length that
+ * may be less than len. Only one reservation may be pending.
+ */
+void* bchan_reserve(bchan_state* s, size_t len);
+void bchan_commit(bchan_state* s, size_t len);
+/* Copy a message of len bytes to the channel, return false if there is not
+ * enough room */
+bool bchan_send(bchan_state* s, const void* data, size_t len);
+
+/* Return the next message and set len to its length, or return NULL if the
+ * channel is empty. The message stays valid until bchan_release.
+ */
+const void* bchan_peek(bchan_state* s, size_t* len);
+void bchan_release(bchan_state* s);
+
+/* Blocking versions of bchan_reserve and bchan_peek, as chan_push_wait */
+void* bchan_reserve_wait(bchan_state* s, size_t len, int64_t timeout_ns);
+const void* bchan_peek_wait(bchan_state* s, size_t* len, int64_t timeout_ns);
+
+#ifdef __linux__
+/* Byte channel between processes, in shared memory. The mapping starts with
+ * a header checked when attaching (magic number, layout version and size),
+ * followed by the area, which holds no pointer. The producer and the
+ * consumer each use their own handle, from create or attach. Waiting works
+ * across processes, at the price of a slower membarrier when parking.
+ * Handles of mapped channels cannot be shared, attach again instead, and
+ * bchan_free unmaps them.
+ */
+/* Create a channel of at least size bytes named name (see shm_open, the
+ * name must not exist), return NULL on failure */
+bchan_state* bchan_shm_create(const char* name, size_t size);
+/* Attach to the channel named name, return NULL if it is missing, not
+ * initialized yet or incompatible. Remove the name with shm_unlink. */
+bchan_state* bchan_shm_attach(const char* name);
+/* Same on a file descriptor, such as one from memfd_create, passed to the
+ * other process. The descriptor can be closed afterward. */
+bchan_state* bchan_fd_create(int fd, size_t size);
+bchan_state* bchan_fd_attach(int fd);
+#endif
+
+/* Multi-producer channels: bounded rings of slots, each slot carrying a
+ * sequence number that tells whether it is free or full for a given round
+ * of the ring (Vyukov's queue). Producers claim a slot with a compare and
+ * swap of the tail index, consumers of mpmc do the same with the head
+ * index, the single consumer of mpsc only reads and increments it.
+ * Each thread uses its own handle, from chan_share_state-like functions.
+ * Same semantics as chan_push, chan_pop and their blocking versions,
+ * messages of each producer arrive in order.
+ */
+typedef struct mpsc_state mpsc_state;
+typedef struct mpmc_state mpmc_state;
+
+mpsc_state* mpsc_new_state(size_t max_nodes);
+mpsc_state* mpsc_share_state(mpsc_state* s);
+void mpsc_free(mpsc_state* s);
+bool mpsc_push(mpsc_state* s, void* data);
+bool mpsc_pop(mpsc_state* s, void** data);
+bool mpsc_push_wait(mpsc_state* s, void* data, int64_t timeout_ns);
+bool mpsc_pop_wait(mpsc_state* s, void** data, int64_t timeout_ns);
+
+mpmc_state* mpmc_new_state(size_t max_nodes);
+mpmc_state* mpmc_share_state(mpmc_state* s);
+void mpmc_free(mpmc_state* s);
+bool mpmc_push(mpmc_state* s, void* data);
+bool mpmc_pop(mpmc_state* s, void** data);
+bool mpmc_push_wait(mpmc_state* s, void* data, int64_t timeout_ns);
+bool mpmc_pop_wait(mpmc_state* s, void** data, int64_t timeout_ns);
+
+/* Selector: wait for data on any of several channels, as their consumer.
+ * The consumer sides of the channels of a selector share its futex, the
+ * producers wake it up instead of the channel. Once added, a channel must
+ * be waited for through the selector, its non-blocking calls still work.
+ * The selector holds a reference to the channels until it is freed.
+ * Channels in shared memory and mpmc channels cannot be selected.
+ */
+typedef struct chan_selector chan_selector;
+
+chan_selector* chan_selector_new(void);
+void chan_selector_free(chan_selector* sel);
+/* Add a channel, return its index in the selector, or -1 on failure */
+int chan_select_add(chan_selector* sel, chan_state* s);
+int bchan_select_add(chan_selector* sel, bchan_state* s);
+int mpsc_select_add(chan_selector* sel, mpsc_state* s);
+
+/* Wait until a channel has data (or a message) and return its index, or
+ * return -1 after timeout_ns nanoseconds (never with a negative timeout).
+ * Channels are checked in turn, starting after the last one returned, so
+ * that a busy channel does not starve the others.
+ */
+int chan_select(chan_selector* sel, int64_t timeout_ns);
+/* Same, but fill ready with the indices of up to n channels having data,
+ * to drain them in one go, and return their number (0 on timeout) */
+size_t chan_select_n(chan_selector* sel, int* ready, size_t n,
+                     int64_t timeout_ns);
+
 #endif
 #ifdef CHAN_IMPL
 
 typedef struct chan_area {
-  size_t max_nodes;
-  size_t head;
-  size_t tail;
-  size_t ref_count;
-  void* nodes[];
+  /* producer side */
+  _Alignas(CHAN_CACHE_LINE) atomic_size_t tail;
+  size_t head_cache;
+  /* start of the pending record of a byte channel */
+  size_t reserved;
+  /* spins of the producer before parking */
+  size_t push_spins;
+
+  /* consumer side */
+  _Alignas(CHAN_CACHE_LINE) atomic_size_t head;
+  size_t tail_cache;
+  size_t pop_spins;
+
+  /* read only after creation */
+  _Alignas(CHAN_CACHE_LINE) size_t mask;
+  atomic_size_t ref_count;
+  /* futex words, set by a side before sleeping */
+  _Atomic uint32_t producer_parked;
+  _Atomic uint32_t consumer_parked;
+  /* in shared memory, between processes */
+  uint32_t process_shared;
+  /* a process of it could not register for membarrier */
+  _Atomic uint32_t no_barrier;
+  /* flag of the selector of the consumer, if any */
+  _Atomic uint32_t* _Atomic consumer_futex;
+  /* producers using consumer_futex, the selector is freed once none is */
+  _Atomic uint32_t waking;
+
+  _Alignas(CHAN_CACHE_LINE) void* nodes[];
 } chan_area;
 
 typedef struct chan_state {
   chan_area* area;
 } chan_state;
 
-static inline bool free_space(chan_area* area) {
-  size_t t = area->tail;
-  size_t h = area->head;
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#endif
+#include <time.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHAN_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CHAN_PAUSE() __asm__ __volatile__("yield")
+#else
+#define CHAN_PAUSE() ((void)0)
+#endif
+
+/* 1 if membarrier is usable, -1 if not, 0 if unknown yet, for the threads
+ * of this process and for all the processes (of channels in shared
+ * memory) */
+static atomic_int chan_membarrier = 0;
+static atomic_int chan_membarrier_global = 0;
+
+/* Register the process for membarrier, once, return true if usable */
+static bool chan_membarrier_register(bool global) {
+  atomic_int* state = global ? &chan_membarrier_global : &chan_membarrier;
+  if (!atomic_load_explicit(state, memory_order_relaxed)) {
+    int registered = -1;
+#ifdef __linux__
+    if (syscall(__NR_membarrier,
+                global ? MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED
+                       : MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+                0, 0) == 0) {
+      registered = 1;
+    }
+#endif
+    atomic_store_explicit(state, registered, memory_order_relaxed);
+  }
+  return atomic_load_explicit(state, memory_order_relaxed) > 0;
+}
+
+/* Full barrier on all the threads of the process (or of all the registered
+ * processes), or on this one only without membarrier */
+static void chan_barrier(bool global) {
+#ifdef __linux__
+  if (atomic_load_explicit(global ? &chan_membarrier_global
+                                  : &chan_membarrier,
+                           memory_order_relaxed) > 0) {
+    syscall(__NR_membarrier,
+            global ? MEMBARRIER_CMD_GLOBAL_EXPEDITED
+                   : MEMBARRIER_CMD_PRIVATE_EXPEDITED,
+            0, 0);
+    return;
+  }
+#endif
+  (void)global;
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static int64_t chan_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleep while *word is 1, for at most ns nanoseconds. Futex operations are
+ * not private to the process, for channels in shared memory. */
+static void chan_futex_wait(_Atomic uint32_t* word, int64_t ns) {
+  struct timespec ts = {ns / 1000000000, ns % 1000000000};
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAIT, 1, &ts, NULL, 0);
+#else
+  (void)word;
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static void chan_futex_wake(_Atomic uint32_t* word) {
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void)word;
+#endif
+}
 
-  if (t == h) {
+/* Slow path of chan_notify: wake up the parked side, all the threads of it
+ * for a multi-producer or multi-consumer channel. The consumer of a channel
+ * in a selector, if redirect is its area, sleeps on the flag of the
+ * selector instead. The producer is counted in waking while it uses that
+ * flag, and chan_selector_free clears consumer_futex then waits for the
+ * count to drop: either the producer reads NULL or the selector waits
+ * (sequentially consistent store and load on both sides). */
+static void chan_wake(_Atomic uint32_t* parked, chan_area* redirect) {
+  if (!atomic_exchange_explicit(parked, 0, memory_order_relaxed)) {
+    return;
+  }
+  if (redirect) {
+    atomic_fetch_add_explicit(&redirect->waking, 1, memory_order_seq_cst);
+    _Atomic uint32_t* selector =
+      atomic_load_explicit(&redirect->consumer_futex, memory_order_seq_cst);
+    /* if lowered, the selector was woken up or has to check again */
+    if (selector && atomic_exchange_explicit(selector, 0,
+                                             memory_order_relaxed)) {
+      chan_futex_wake(selector);
+    }
+    atomic_fetch_sub_explicit(&redirect->waking, 1, memory_order_release);
+    if (selector) {
+      return;
+    }
+  }
+  chan_futex_wake(parked);
+}
+
+/* Called after publishing an index, wake up the other side if it is parked.
+ * The publishing side only has a compiler barrier between its store and the
+ * load of the flag, the hardware barrier is issued by the parking side with
+ * membarrier, which keeps the hot path free of fences. */
+static inline void chan_notify(_Atomic uint32_t* parked,
+                               chan_area* redirect) {
+  atomic_signal_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(parked, memory_order_relaxed)) {
+    chan_wake(parked, redirect);
+  }
+}
+
+static inline void chan_publish_tail(chan_area* a, size_t tail) {
+  atomic_store_explicit(&a->tail, tail, memory_order_release);
+  chan_notify(&a->consumer_parked, a);
+}
+
+static inline void chan_publish_head(chan_area* a, size_t head) {
+  atomic_store_explicit(&a->head, head, memory_order_release);
+  chan_notify(&a->producer_parked, NULL);
+}
+
+/* State of a blocking call, between attempts of the operation */
+typedef struct {
+  _Atomic uint32_t* parked;
+  /* other threads may wait on the same flag */
+  bool shared;
+  /* the other side is in another process */
+  bool global;
+  /* a wake up may be missed, sleep by short slices */
+  bool sliced;
+  /* called before raising the flag, to raise other flags */
+  void (*raise)(void* arg);
+  void* raise_arg;
+  size_t* spins;
+  size_t count;
+  int64_t timeout_ns;
+  int64_t deadline;
+} chan_waiter;
+
+static void chan_wait_start(chan_waiter* w, chan_area* a,
+                            _Atomic uint32_t* parked, bool shared,
+                            size_t* spins, int64_t timeout_ns) {
+  w->parked = parked;
+  w->shared = shared;
+  w->global = a && a->process_shared;
+  w->sliced = !chan_membarrier_register(w->global) ||
+              (a && atomic_load_explicit(&a->no_barrier, memory_order_relaxed));
+  w->raise = NULL;
+  w->spins = spins;
+  w->count = 0;
+  w->timeout_ns = timeout_ns;
+  w->deadline = timeout_ns > 0 ? chan_now() + timeout_ns : 0;
+}
+
+/* Wait a little after a failed attempt: spin, then raise the flag (the
+ * caller tries again before sleeping), then sleep until woken up.
+ * Return false when the timeout expired. */
+static bool chan_wait_step(chan_waiter* w) {
+  if (!w->timeout_ns) {
+    return false;
+  }
+  if (w->count < *w->spins) {
+    w->count++;
+    CHAN_PAUSE();
     return true;
-  } else if (t < h) {
-    t += area->max_nodes;
   }
 
-  return t - h < area->max_nodes;
+  /* the flag may have been raised by another waiter, or lowered by a wake
+   * up, each waiter raises it itself before its last try */
+  if (w->count == *w->spins ||
+      !atomic_load_explicit(w->parked, memory_order_relaxed)) {
+    if (w->raise) {
+      w->raise(w->raise_arg);
+    }
+    atomic_store_explicit(w->parked, 1, memory_order_relaxed);
+    chan_barrier(w->global);
+    w->count++;
+    return true;
+  }
+
+  int64_t ns = CHAN_PARK_NS;
+  if (w->timeout_ns > 0) {
+    int64_t left = w->deadline - chan_now();
+    if (left <= 0) {
+      return false;
+    }
+    ns = left < ns ? left : ns;
+  }
+  if (w->sliced && ns > CHAN_PARK_SLICE_NS) {
+    ns = CHAN_PARK_SLICE_NS;
+  }
+  chan_futex_wait(w->parked, ns);
+  w->count++;
+  return true;
+}
+
+/* Lower the flag and adapt the spins: spin longer when spinning was enough,
+ * shorter when the call had to sleep anyway. A shared flag stays raised for
+ * the other waiters, the next wake up lowers it. */
+static void chan_wait_end(chan_waiter* w) {
+  if (w->count > *w->spins) {
+    if (!w->shared) {
+      atomic_store_explicit(w->parked, 0, memory_order_relaxed);
+    }
+    if (*w->spins > CHAN_MIN_SPINS) {
+      *w->spins /= 2;
+    }
+  } else if (w->count && *w->spins < CHAN_MAX_SPINS) {
+    *w->spins *= 2;
+  }
+}
+
+/* Number of free nodes for the producer, reading head again only if the
+ * cached copy gives less than n */
+static inline size_t chan_free_nodes(chan_area* a, size_t tail, size_t n) {
+  size_t free_nodes = a->mask + 1 - (tail - a->head_cache);
+  if (free_nodes < n) {
+    a->head_cache = atomic_load_explicit(&a->head, memory_order_acquire);
+    free_nodes = a->mask + 1 - (tail - a->head_cache);
+  }
+  return free_nodes;
 }
 
-static inline bool ready(chan_area* area) {
-  return area->tail != area->head;
+/* Number of used nodes for the consumer, reading tail again only if the
+ * cached copy gives less than n */
+static inline size_t chan_used_nodes(chan_area* a, size_t head, size_t n) {
+  size_t used_nodes = a->tail_cache - head;
+  if (used_nodes < n) {
+    a->tail_cache = atomic_load_explicit(&a->tail, memory_order_acquire);
+    used_nodes = a->tail_cache - head;
+  }
+  return used_nodes;
 }
 
 bool chan_pop(chan_state* s, void** data) {
-  size_t c = s->area->head;
-  size_t head = (c + 1) % s->area->max_nodes;
-  if (ready(s->area)) {
-    *data = NULL;
-    return false;
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  if (head == a->tail_cache) {
+    a->tail_cache = atomic_load_explicit(&a->tail, memory_order_acquire);
+    if (head == a->tail_cache) {
+      *data = NULL;
+      return false;
+    }
   }
-  s->area->head = head;
-  *data = s->area->nodes[c];
+  *data = a->nodes[head & a->mask];
+  chan_publish_head(a, head + 1);
   return true;
 }
 
 bool chan_push(chan_state* s, void* data) {
-  size_t c = s->area->tail;
-  size_t tail = (c + 1) % s->area->max_nodes;
-  if (free_space(s->area)) {
-    return false;
+  chan_area* a = s->area;
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  if (tail - a->head_cache > a->mask) {
+    a->head_cache = atomic_load_explicit(&a->head, memory_order_acquire);
+    if (tail - a->head_cache > a->mask) {
+      return false;
+    }
   }
-  s->area->tail = tail;
-  s->area->nodes[c] = data;
+  a->nodes[tail & a->mask] = data;
+  chan_publish_tail(a, tail + 1);
   return true;
 }
 
-chan_state* chan_new_state(size_t max_nodes) {
-  chan_area* a = malloc(max_nodes * sizeof(void *) + 4 * sizeof(size_t));
-  chan_state* s = malloc(sizeof(struct chan_state));
+size_t chan_push_n(chan_state* s, void** data, size_t n) {
+  chan_area* a = s->area;
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  size_t free_nodes = chan_free_nodes(a, tail, n);
+  if (n > free_nodes) {
+    n = free_nodes;
+  }
+  for (size_t i = 0; i < n; i++) {
+    a->nodes[(tail + i) & a->mask] = data[i];
+  }
+  if (n) {
+    chan_publish_tail(a, tail + n);
+  }
+  return n;
+}
+
+size_t chan_pop_n(chan_state* s, void** data, size_t n) {
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  size_t used_nodes = chan_used_nodes(a, head, n);
+  if (n > used_nodes) {
+    n = used_nodes;
+  }
+  for (size_t i = 0; i < n; i++) {
+    data[i] = a->nodes[(head + i) & a->mask];
+  }
+  if (n) {
+    chan_publish_head(a, head + n);
+  }
+  return n;
+}
+
+size_t chan_reserve(chan_state* s, void*** nodes, size_t n) {
+  chan_area* a = s->area;
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  size_t start = tail & a->mask;
+  /* stop at the end of the ring */
+  if (n > a->mask + 1 - start) {
+    n = a->mask + 1 - start;
+  }
+  size_t free_nodes = chan_free_nodes(a, tail, n);
+  *nodes = &a->nodes[start];
+  return n < free_nodes ? n : free_nodes;
+}
+
+void chan_commit(chan_state* s, size_t k) {
+  chan_area* a = s->area;
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  chan_publish_tail(a, tail + k);
+}
+
+size_t chan_peek(chan_state* s, void*** nodes, size_t n) {
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  size_t start = head & a->mask;
+  if (n > a->mask + 1 - start) {
+    n = a->mask + 1 - start;
+  }
+  size_t used_nodes = chan_used_nodes(a, head, n);
+  *nodes = &a->nodes[start];
+  return n < used_nodes ? n : used_nodes;
+}
+
+void chan_release(chan_state* s, size_t k) {
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  chan_publish_head(a, head + k);
+}
+
+bool chan_push_wait(chan_state* s, void* data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->producer_parked, false,
+                  &s->area->push_spins, timeout_ns);
+  bool done;
+  while (!(done = chan_push(s, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+bool chan_pop_wait(chan_state* s, void** data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->consumer_parked, false,
+                  &s->area->pop_spins, timeout_ns);
+  bool done;
+  while (!(done = chan_pop(s, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+/* Capacity of an area of at least n elements of elem_size bytes, a power
+ * of two, or 0 if it is too large */
+static size_t chan_capacity(size_t n, size_t elem_size) {
+  size_t capacity = 1;
+  while (capacity < n) {
+    if (capacity > (SIZE_MAX - sizeof(chan_area)) / 2 / elem_size) {
+      return 0;
+    }
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+/* Size of an area, a multiple of the cache line */
+static size_t chan_area_size(size_t capacity, size_t elem_size) {
+  size_t size = sizeof(chan_area) + capacity * elem_size;
+  return (size + CHAN_CACHE_LINE - 1) & ~(size_t)(CHAN_CACHE_LINE - 1);
+}
+
+static void chan_init_area(chan_area* a, size_t capacity) {
+  atomic_init(&a->tail, 0);
+  a->head_cache = 0;
+  a->reserved = 0;
+  a->push_spins = CHAN_MIN_SPINS;
+  atomic_init(&a->head, 0);
+  a->tail_cache = 0;
+  a->pop_spins = CHAN_MIN_SPINS;
+  a->mask = capacity - 1;
+  atomic_init(&a->ref_count, 1);
+  atomic_init(&a->producer_parked, 0);
+  atomic_init(&a->consumer_parked, 0);
+  a->process_shared = 0;
+  atomic_init(&a->no_barrier, 0);
+  atomic_init(&a->consumer_futex, NULL);
+  atomic_init(&a->waking, 0);
+}
 
+/* Allocate an area of at least n elements of elem_size bytes, rounded up
+ * to a power of two */
+static chan_area* chan_new_area(size_t n, size_t elem_size) {
+  size_t capacity = chan_capacity(n, elem_size);
+  if (!capacity) {
+    return NULL;
+  }
+  chan_area* a = aligned_alloc(CHAN_CACHE_LINE,
+                               chan_area_size(capacity, elem_size));
   if (!a) {
-    s->area = NULL;
-  } else {
-    a->max_nodes = max_nodes;
-    a->head = 0;
-    a->tail = 0;
-    a->ref_count = 1;
-    s->area = a;
+    return NULL;
+  }
+  chan_init_area(a, capacity);
+  chan_membarrier_register(false);
+  return a;
+}
+
+/* Drop a reference to an area, free it with the last one */
+static void chan_release_area(chan_area* a) {
+  if (atomic_fetch_sub_explicit(&a->ref_count, 1,
+                                memory_order_acq_rel) == 1) {
+    free(a);
   }
+}
 
+chan_state* chan_new_state(size_t max_nodes) {
+  chan_state* s = malloc(sizeof(struct chan_state));
+  if (!s) {
+    return NULL;
+  }
+  s->area = chan_new_area(max_nodes, sizeof(void *));
+  if (!s->area) {
+    free(s);
+    return NULL;
+  }
   return s;
 }
 
 chan_state* chan_share_state(chan_state* s) {
-  ++s->area;
   chan_state* s2 = malloc(sizeof(struct chan_state));
+  if (!s2) {
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&s->area->ref_count, 1, memory_order_relaxed);
   s2->area = s->area;
   return s2;
 }
 
 void chan_free(chan_state* s) {
-  if (!--s->area->ref_count) {
-    free(s->area);
+  chan_release_area(s->area);
+  free(s);
+}
+
+/* Records of the byte channel are a header followed by the message and
+ * padded to the header size, so that headers are aligned. */
+#define BCHAN_HEADER sizeof(size_t)
+#define BCHAN_RECORD(len) \
+  (((len) + 2 * BCHAN_HEADER - 1) & ~(BCHAN_HEADER - 1))
+/* header of the record filling the end of the ring */
+#define BCHAN_PAD SIZE_MAX
+
+typedef struct bchan_state {
+  chan_area* area;
+  /* size of the shared memory mapping holding area, 0 if allocated */
+  size_t mapped;
+} bchan_state;
+
+static inline size_t* bchan_header(chan_area* a, size_t index) {
+  return (size_t*)((char*)a->nodes + (index & a->mask));
+}
+
+bchan_state* bchan_new_state(size_t size) {
+  bchan_state* s = malloc(sizeof(struct bchan_state));
+  if (!s) {
+    return NULL;
+  }
+  s->mapped = 0;
+  s->area = chan_new_area(size < BCHAN_MIN_SIZE ? BCHAN_MIN_SIZE : size, 1);
+  if (!s->area) {
+    free(s);
+    return NULL;
   }
+  return s;
+}
+
+bchan_state* bchan_share_state(bchan_state* s) {
+  bchan_state* s2 = s->mapped ? NULL : malloc(sizeof(struct bchan_state));
+  if (!s2) {
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&s->area->ref_count, 1, memory_order_relaxed);
+  s2->area = s->area;
+  s2->mapped = 0;
+  return s2;
+}
+
+void bchan_free(bchan_state* s) {
+#ifdef __linux__
+  if (s->mapped) {
+    munmap((char*)s->area - CHAN_SHM_OFFSET, s->mapped);
+    free(s);
+    return;
+  }
+#endif
+  chan_release_area(s->area);
   free(s);
 }
+
+void* bchan_reserve(bchan_state* s, size_t len) {
+  chan_area* a = s->area;
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  size_t record = BCHAN_RECORD(len);
+  size_t start = tail;
+  size_t end_space = a->mask + 1 - (tail & a->mask);
+
+  if (len > a->mask + 1 || record > a->mask + 1) {
+    return NULL;
+  }
+  /* a record never wraps, the end of the ring is skipped */
+  if (record > end_space) {
+    start += end_space;
+  }
+  if (chan_free_nodes(a, tail, start - tail + record) < start - tail + record) {
+    return NULL;
+  }
+  if (start != tail) {
+    *bchan_header(a, tail) = BCHAN_PAD;
+  }
+  a->reserved = start;
+  return bchan_header(a, start) + 1;
+}
+
+void bchan_commit(bchan_state* s, size_t len) {
+  chan_area* a = s->area;
+  *bchan_header(a, a->reserved) = len;
+  chan_publish_tail(a, a->reserved + BCHAN_RECORD(len));
+}
+
+bool bchan_send(bchan_state* s, const void* data, size_t len) {
+  void* buf = bchan_reserve(s, len);
+  if (!buf) {
+    return false;
+  }
+  memcpy(buf, data, len);
+  bchan_commit(s, len);
+  return true;
+}
+
+const void* bchan_peek(bchan_state* s, size_t* len) {
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  if (!chan_used_nodes(a, head, 1)) {
+    return NULL;
+  }
+  size_t* header = bchan_header(a, head);
+  if (*header == BCHAN_PAD) {
+    /* the record after the padding was published with it */
+    head += a->mask + 1 - (head & a->mask);
+    chan_publish_head(a, head);
+    header = bchan_header(a, head);
+  }
+  *len = *header;
+  return header + 1;
+}
+
+void bchan_release(bchan_state* s) {
+  chan_area* a = s->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  chan_publish_head(a, head + BCHAN_RECORD(*bchan_header(a, head)));
+}
+void* bchan_reserve_wait(bchan_state* s, size_t len, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->producer_parked, false,
+                  &s->area->push_spins, timeout_ns);
+  void* buf;
+  while (!(buf = bchan_reserve(s, len)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return buf;
+}
+
+const void* bchan_peek_wait(bchan_state* s, size_t* len, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->consumer_parked, false,
+                  &s->area->pop_spins, timeout_ns);
+  const void* msg;
+  while (!(msg = bchan_peek(s, len)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return msg;
+}
+
+#ifdef __linux__
+/* Start of a shared memory mapping, the area follows at CHAN_SHM_OFFSET.
+ * The magic number is written last by the creator. */
+typedef struct chan_shm_header {
+  _Atomic uint64_t magic;
+  uint32_t version;
+  /* sizeof(chan_area), changes with the layout */
+  uint32_t area_size;
+  uint64_t size;
+} chan_shm_header;
+
+/* Map the channel of fd, initialize it if size is not 0 */
+static bchan_state* bchan_map(int fd, size_t size) {
+  bchan_state* s = malloc(sizeof(struct bchan_state));
+  if (!s) {
+    return NULL;
+  }
+  size_t capacity = 0;
+  if (size) {
+    capacity = chan_capacity(size < BCHAN_MIN_SIZE ? BCHAN_MIN_SIZE : size, 1);
+    size = CHAN_SHM_OFFSET + chan_area_size(capacity, 1);
+    if (!capacity || ftruncate(fd, (off_t)size)) {
+      free(s);
+      return NULL;
+    }
+  } else {
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < CHAN_SHM_OFFSET) {
+      free(s);
+      return NULL;
+    }
+    size = (size_t)st.st_size;
+  }
+
+  chan_shm_header* h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, 0);
+  if (h == MAP_FAILED) {
+    free(s);
+    return NULL;
+  }
+  s->area = (chan_area*)((char*)h + CHAN_SHM_OFFSET);
+  s->mapped = size;
+
+  if (capacity) {
+    chan_init_area(s->area, capacity);
+    s->area->process_shared = 1;
+    h->version = CHAN_SHM_VERSION;
+    h->area_size = sizeof(chan_area);
+    h->size = size;
+    atomic_store_explicit(&h->magic, CHAN_SHM_MAGIC, memory_order_release);
+  } else if (atomic_load_explicit(&h->magic, memory_order_acquire)
+               != CHAN_SHM_MAGIC ||
+             h->version != CHAN_SHM_VERSION ||
+             h->area_size != sizeof(chan_area) || h->size != size ||
+             CHAN_SHM_OFFSET + chan_area_size(s->area->mask + 1, 1) != size) {
+    munmap(h, size);
+    free(s);
+    return NULL;
+  }
+
+  if (!chan_membarrier_register(true)) {
+    atomic_store_explicit(&s->area->no_barrier, 1, memory_order_relaxed);
+  }
+  return s;
+}
+
+bchan_state* bchan_fd_create(int fd, size_t size) {
+  return bchan_map(fd, size ? size : 1);
+}
+
+bchan_state* bchan_fd_attach(int fd) {
+  return bchan_map(fd, 0);
+}
+
+bchan_state* bchan_shm_create(const char* name, size_t size) {
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return NULL;
+  }
+  bchan_state* s = bchan_fd_create(fd, size);
+  close(fd);
+  if (!s) {
+    shm_unlink(name);
+  }
+  return s;
+}
+
+bchan_state* bchan_shm_attach(const char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  bchan_state* s = bchan_fd_attach(fd);
+  close(fd);
+  return s;
+}
+#endif
+
+/* Slots of the multi-producer channels, in the nodes of the area */
+typedef struct chan_slot {
+  atomic_size_t seq;
+  void* data;
+} chan_slot;
+
+/* Handles hold the spins of their thread, the area is shared */
+typedef struct mpsc_state {
+  chan_area* area;
+  size_t spins;
+} mpsc_state;
+
+typedef struct mpmc_state {
+  chan_area* area;
+  size_t spins;
+} mpmc_state;
+
+static inline chan_slot* chan_slot_at(chan_area* a, size_t index) {
+  return (chan_slot*)a->nodes + (index & a->mask);
+}
+
+/* Slot of index i is free for the round of i when its sequence is i, and
+ * full when it is i + 1 */
+static chan_area* chan_new_slots(size_t max_nodes) {
+  chan_area* a = chan_new_area(max_nodes, sizeof(chan_slot));
+  if (a) {
+    for (size_t i = 0; i <= a->mask; i++) {
+      atomic_init(&chan_slot_at(a, i)->seq, i);
+    }
+  }
+  return a;
+}
+
+static bool chan_slots_push(chan_area* a, void* data) {
+  size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  chan_slot* slot;
+  for (;;) {
+    slot = chan_slot_at(a, tail);
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)(seq - tail);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+            &a->tail, &tail, tail + 1,
+            memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* not consumed since the previous round, full */
+      return false;
+    } else {
+      /* claimed by another producer */
+      tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    }
+  }
+  slot->data = data;
+  atomic_store_explicit(&slot->seq, tail + 1, memory_order_release);
+  chan_notify(&a->consumer_parked, a);
+  return true;
+}
+
+/* single consumer, no other thread changes head */
+static bool chan_slots_pop_one(chan_area* a, void** data) {
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  chan_slot* slot = chan_slot_at(a, head);
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + 1) {
+    *data = NULL;
+    return false;
+  }
+  *data = slot->data;
+  atomic_store_explicit(&a->head, head + 1, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, head + a->mask + 1, memory_order_release);
+  chan_notify(&a->producer_parked, NULL);
+  return true;
+}
+
+static bool chan_slots_pop(chan_area* a, void** data) {
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  chan_slot* slot;
+  for (;;) {
+    slot = chan_slot_at(a, head);
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)(seq - (head + 1));
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+            &a->head, &head, head + 1,
+            memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* not produced yet, empty */
+      *data = NULL;
+      return false;
+    } else {
+      head = atomic_load_explicit(&a->head, memory_order_relaxed);
+    }
+  }
+  *data = slot->data;
+  atomic_store_explicit(&slot->seq, head + a->mask + 1, memory_order_release);
+  chan_notify(&a->producer_parked, NULL);
+  return true;
+}
+
+mpsc_state* mpsc_new_state(size_t max_nodes) {
+  mpsc_state* s = malloc(sizeof(struct mpsc_state));
+  if (!s) {
+    return NULL;
+  }
+  s->area = chan_new_slots(max_nodes);
+  s->spins = CHAN_MIN_SPINS;
+  if (!s->area) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+mpsc_state* mpsc_share_state(mpsc_state* s) {
+  mpsc_state* s2 = malloc(sizeof(struct mpsc_state));
+  if (!s2) {
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&s->area->ref_count, 1, memory_order_relaxed);
+  s2->area = s->area;
+  s2->spins = CHAN_MIN_SPINS;
+  return s2;
+}
+
+void mpsc_free(mpsc_state* s) {
+  chan_release_area(s->area);
+  free(s);
+}
+
+bool mpsc_push(mpsc_state* s, void* data) {
+  return chan_slots_push(s->area, data);
+}
+
+bool mpsc_pop(mpsc_state* s, void** data) {
+  return chan_slots_pop_one(s->area, data);
+}
+
+bool mpsc_push_wait(mpsc_state* s, void* data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->producer_parked, true,
+                  &s->spins, timeout_ns);
+  bool done;
+  while (!(done = chan_slots_push(s->area, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+bool mpsc_pop_wait(mpsc_state* s, void** data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->consumer_parked, false,
+                  &s->spins, timeout_ns);
+  bool done;
+  while (!(done = chan_slots_pop_one(s->area, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+mpmc_state* mpmc_new_state(size_t max_nodes) {
+  mpmc_state* s = malloc(sizeof(struct mpmc_state));
+  if (!s) {
+    return NULL;
+  }
+  s->area = chan_new_slots(max_nodes);
+  s->spins = CHAN_MIN_SPINS;
+  if (!s->area) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+mpmc_state* mpmc_share_state(mpmc_state* s) {
+  mpmc_state* s2 = malloc(sizeof(struct mpmc_state));
+  if (!s2) {
+    return NULL;
+  }
+  atomic_fetch_add_explicit(&s->area->ref_count, 1, memory_order_relaxed);
+  s2->area = s->area;
+  s2->spins = CHAN_MIN_SPINS;
+  return s2;
+}
+
+void mpmc_free(mpmc_state* s) {
+  chan_release_area(s->area);
+  free(s);
+}
+
+bool mpmc_push(mpmc_state* s, void* data) {
+  return chan_slots_push(s->area, data);
+}
+
+bool mpmc_pop(mpmc_state* s, void** data) {
+  return chan_slots_pop(s->area, data);
+}
+
+bool mpmc_push_wait(mpmc_state* s, void* data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->producer_parked, true,
+                  &s->spins, timeout_ns);
+  bool done;
+  while (!(done = chan_slots_push(s->area, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+bool mpmc_pop_wait(mpmc_state* s, void** data, int64_t timeout_ns) {
+  chan_waiter w;
+  chan_wait_start(&w, s->area, &s->area->consumer_parked, true,
+                  &s->spins, timeout_ns);
+  bool done;
+  while (!(done = chan_slots_pop(s->area, data)) && chan_wait_step(&w)) {
+  }
+  chan_wait_end(&w);
+  return done;
+}
+
+/* kinds of channels in a selector */
+enum { CHAN_SELECT_RING, CHAN_SELECT_SLOTS };
+
+typedef struct chan_select_entry {
+  chan_area* area;
+  int kind;
+} chan_select_entry;
+
+typedef struct chan_selector {
+  _Atomic uint32_t parked;
+  size_t spins;
+  chan_select_entry* entries;
+  size_t count;
+  size_t capacity;
+  /* entry checked first by the next call */
+  size_t next;
+} chan_selector;
+
+chan_selector* chan_selector_new(void) {
+  chan_selector* sel = malloc(sizeof(struct chan_selector));
+  if (!sel) {
+    return NULL;
+  }
+  atomic_init(&sel->parked, 0);
+  sel->spins = CHAN_MIN_SPINS;
+  sel->entries = NULL;
+  sel->count = sel->capacity = 0;
+  sel->next = 0;
+  return sel;
+}
+
+void chan_selector_free(chan_selector* sel) {
+  for (size_t i = 0; i < sel->count; i++) {
+    chan_area* a = sel->entries[i].area;
+    atomic_store_explicit(&a->consumer_futex, NULL, memory_order_seq_cst);
+    /* a producer may still be waking the selector up, see chan_wake */
+    for (int spins = 0;
+         atomic_load_explicit(&a->waking, memory_order_seq_cst); spins++) {
+      if (spins < CHAN_MIN_SPINS) {
+        CHAN_PAUSE();
+      } else {
+        sched_yield();
+      }
+    }
+    atomic_thread_fence(memory_order_acquire);
+    chan_release_area(a);
+  }
+  free(sel->entries);
+  free(sel);
+}
+
+static int chan_select_add_area(chan_selector* sel, chan_area* a, int kind) {
+  if (a->process_shared || sel->count >= INT_MAX ||
+      atomic_load_explicit(&a->consumer_futex, memory_order_relaxed)) {
+    return -1;
+  }
+  if (sel->count == sel->capacity) {
+    size_t capacity = sel->capacity ? 2 * sel->capacity : 8;
+    chan_select_entry* entries =
+      realloc(sel->entries, capacity * sizeof(chan_select_entry));
+    if (!entries) {
+      return -1;
+    }
+    sel->entries = entries;
+    sel->capacity = capacity;
+  }
+  atomic_fetch_add_explicit(&a->ref_count, 1, memory_order_relaxed);
+  atomic_store_explicit(&a->consumer_futex, &sel->parked,
+                        memory_order_release);
+  sel->entries[sel->count].area = a;
+  sel->entries[sel->count].kind = kind;
+  return (int)sel->count++;
+}
+
+int chan_select_add(chan_selector* sel, chan_state* s) {
+  return chan_select_add_area(sel, s->area, CHAN_SELECT_RING);
+}
+
+int bchan_select_add(chan_selector* sel, bchan_state* s) {
+  return chan_select_add_area(sel, s->area, CHAN_SELECT_RING);
+}
+
+int mpsc_select_add(chan_selector* sel, mpsc_state* s) {
+  return chan_select_add_area(sel, s->area, CHAN_SELECT_SLOTS);
+}
+
+/* true if the consumer of the entry would get something */
+static bool chan_select_ready(chan_select_entry* e) {
+  chan_area* a = e->area;
+  size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  if (e->kind == CHAN_SELECT_RING) {
+    return chan_used_nodes(a, head, 1) != 0;
+  }
+  return atomic_load_explicit(&chan_slot_at(a, head)->seq,
+                              memory_order_acquire) == head + 1;
+}
+
+/* Raise the flags of all the channels before sleeping */
+static void chan_select_raise(void* arg) {
+  chan_selector* sel = arg;
+  for (size_t i = 0; i < sel->count; i++) {
+    atomic_store_explicit(&sel->entries[i].area->consumer_parked, 1,
+                          memory_order_relaxed);
+  }
+}
+
+/* Collect up to n ready channels, starting at sel->next */
+static size_t chan_select_scan(chan_selector* sel, int* ready, size_t n) {
+  size_t found = 0;
+  for (size_t k = 0; k < sel->count && found < n; k++) {
+    size_t i = (sel->next + k) % sel->count;
+    if (chan_select_ready(&sel->entries[i])) {
+      ready[found++] = (int)i;
+    }
+  }
+  if (found) {
+    sel->next = ((size_t)ready[found - 1] + 1) % sel->count;
+  }
+  return found;
+}
+
+size_t chan_select_n(chan_selector* sel, int* ready, size_t n,
+                     int64_t timeout_ns) {
+  if (!sel->count || !n) {
+    return 0;
+  }
+  chan_waiter w;
+  chan_wait_start(&w, NULL, &sel->parked, false, &sel->spins, timeout_ns);
+  w.raise = chan_select_raise;
+  w.raise_arg = sel;
+  size_t found;
+  while (!(found = chan_select_scan(sel, ready, n)) && chan_wait_step(&w)) {
+  }
+  if (w.count > sel->spins) {
+    /* the consumer is this thread, nobody else needs the flags */
+    for (size_t i = 0; i < sel->count; i++) {
+      atomic_store_explicit(&sel->entries[i].area->consumer_parked, 0,
+                            memory_order_relaxed);
+    }
+  }
+  chan_wait_end(&w);
+  return found;
+}
+
+int chan_select(chan_selector* sel, int64_t timeout_ns) {
+  int ready;
+  return chan_select_n(sel, &ready, 1, timeout_ns) ? ready : -1;
+}
 #endif
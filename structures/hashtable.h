@@ -444,6 +444,9 @@ void ht_set_deallocation_functions(HashTable* hashTable,
  *      A hash function that is appropriate for hashing strings.  Note that
  *      this is not the default hash function.  To make it the default hash
  *      function, call ht_set_hash_function(ht_string_hash_function).
+ *      It reads one byte at a time and anyone can compute its collisions:
+ *      for long keys, or keys coming from untrusted input, prefer
+ *      wyhash_string() from hash/wyhash.h with a random seed.
  *  ARGUMENTS:
  *      key    - the key to be hashed
  *  RETURNS:
@@ -0,0 +1,424 @@
+/*--------------------------------------------------------------------------*\
+ * Heap implementation by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Priority queue stored in a growable array as a 4-ary heap: the four
+ * children of a node are contiguous, usually in the same cache line, and
+ * the tree is half as deep as a binary heap.
+ *
+ * Same conventions as avl.h: entries are key-value pairs of void*, keys are
+ * compared with a heap_comparator_f and the smallest key comes first.
+ * Same key managment contract as avl.h:
+ * - user MUST allocate keys
+ * - user MUST NOT destroy key
+ * - heap_ MUST destroy keys when they are not needed anymore
+ *
+ * An indexed heap also keeps the position of each entry, so that the key of
+ * an entry can be changed (decrease-key) or the entry removed, through the
+ * handle returned by heap_push.
+ *
+ * Documentation is just before each function in header part (just below).
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if HEAP_IMPLEMENTATION
+ * is defined.
+ * Jump to HEAP_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef HEAP_H
+#define HEAP_H
+
+/* memory allocation macros, change as necessary */
+#define HEAP_REALLOC(variable, type, n) \
+  (type *)realloc(variable, (n) * sizeof(type))
+#define HEAP_FREE(variable) free(variable)
+#include <stdlib.h> /* for realloc() */
+
+/* number of children of a node */
+#define HEAP_ARITY 4
+/* capacity of the first allocation */
+#define HEAP_MIN_CAPACITY 16
+/* returned by heap_push when the heap is not indexed */
+#define HEAP_NO_HANDLE ((size_t)-1)
+/* returned by heap_push when the entry could not be stored */
+#define HEAP_NO_MEMORY ((size_t)-2)
+
+typedef int (*heap_comparator_f)(const void* key1, const void* key2);
+typedef void (*heap_key_destructor_f)(void* key);
+typedef void (*heap_node_visitor_f)(const void* key, void* data);
+
+typedef struct {
+  void* key;
+  void* data;
+  size_t handle;
+} HeapEntry;
+
+typedef struct {
+  HeapEntry* entries;
+  size_t size;
+  size_t capacity;
+  heap_comparator_f comparator;
+  heap_key_destructor_f destructor;
+
+  /* index map: position of the entry of each handle, or next free handle */
+  int indexed;
+  size_t* positions;
+  size_t handles;
+  size_t free_handle;
+} Heap;
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_initialize() - initialize a new heap
+ *  DESCRIPTION:
+ *      Initialize a heap. The user have to own the memory corresponding to
+ *      the heap. It should be cleaned with heap_destroy.
+ *  ARGUMENTS:
+ *      heap        - a pointer to the heap to initialize
+ *      comparator  - a heap_comparator_f function pointer ((void*, void*) -> int)
+ *                    to compare keys
+ *      destructor  - a heap_key_destructor_f function pointer (void* -> void)
+ *                    to destroy keys
+ *      indexed     - non zero to keep handles for heap_update and
+ *                    heap_remove
+\*--------------------------------------------------------------------------*/
+void heap_initialize(Heap* heap,
+                     heap_comparator_f comparator,
+                     heap_key_destructor_f destructor,
+                     int indexed);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_destroy() - destroy a heap
+ *  ARGUMENTS:
+ *      heap        - a pointer to the heap to destroy
+ *      visitor     - a heap_node_visitor_f function pointer ((void *key, void *data) -> void)
+ *                    Applied on each key-value pair before destroying it.
+ *                    visitor should NOT free the key.
+ *                    Use NULL when you don't want the data to be freed.
+\*--------------------------------------------------------------------------*/
+void heap_destroy(Heap* heap, heap_node_visitor_f visitor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_push() - insert a key-value pair
+ *  DESCRIPTION:
+ *      Several entries may have the same key. Return the handle of the
+ *      entry in an indexed heap, valid until the entry leaves the heap,
+ *      HEAP_NO_HANDLE otherwise.
+ *      Return HEAP_NO_MEMORY if the heap could not grow: the entry is not
+ *      inserted and the key is still owned by the user.
+ *  EFFICIENCY:
+ *      O(log(n)), amortized O(1) memory allocation
+\*--------------------------------------------------------------------------*/
+size_t heap_push(Heap* heap, void* key, void* data);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_peek() - return the data of the smallest key
+ *  DESCRIPTION:
+ *      Return NULL if the heap is empty. If key is not NULL, it receives the
+ *      smallest key, or NULL.
+ *  EFFICIENCY:
+ *      O(1)
+\*--------------------------------------------------------------------------*/
+void* heap_peek(Heap* heap, const void** key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_pop() - remove the entry of the smallest key
+ *  DESCRIPTION:
+ *      Return the data of the entry, NULL if the heap is empty.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* heap_pop(Heap* heap);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_update() - change the key of an entry
+ *  DESCRIPTION:
+ *      Replace the key of the entry of handle, in an indexed heap, and
+ *      restore the heap order. Smaller keys (decrease-key) move toward the
+ *      top, larger ones toward the bottom.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void heap_update(Heap* heap, size_t handle, void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_remove() - remove an entry
+ *  DESCRIPTION:
+ *      Remove the entry of handle, in an indexed heap, and return its data.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* heap_remove(Heap* heap, size_t handle);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      heap_size() - return the number of entries
+ *  EFFICIENCY:
+ *      O(1)
+\*--------------------------------------------------------------------------*/
+size_t heap_size(Heap* heap);
+
+#endif
+
+#ifdef HEAP_IMPLEMENTATION
+/* required definitions */
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+/* put entry at position i or above, moving larger parents down */
+static void heap_sift_up(Heap* heap, size_t i, HeapEntry entry);
+/* put entry at position i or below, moving smaller children up */
+static void heap_sift_down(Heap* heap, size_t i, HeapEntry entry);
+/* fill the hole at the top with entry, which comes from the bottom */
+static void heap_sift_bottom_up(Heap* heap, HeapEntry entry);
+/* store entry at position i and record it in the index */
+static void heap_place(Heap* heap, size_t i, HeapEntry entry);
+/* remove the entry at position i and return it */
+static HeapEntry heap_take(Heap* heap, size_t i);
+/* get a free handle, growing the index as needed */
+static size_t heap_new_handle(Heap* heap);
+
+void heap_initialize(Heap* heap, heap_comparator_f comparator,
+                     heap_key_destructor_f destructor, int indexed) {
+
+  heap->entries = NULL;
+  heap->size = heap->capacity = 0;
+  heap->comparator = comparator;
+  heap->destructor = destructor;
+  heap->indexed = indexed;
+  heap->positions = NULL;
+  heap->handles = 0;
+  heap->free_handle = HEAP_NO_HANDLE;
+}
+
+void heap_destroy(Heap* heap, heap_node_visitor_f visitor) {
+  size_t i;
+  for (i = 0; i < heap->size; i++) {
+    if (visitor) {
+      visitor(heap->entries[i].key, heap->entries[i].data);
+    }
+    if (heap->destructor) {
+      heap->destructor(heap->entries[i].key);
+    }
+  }
+  HEAP_FREE(heap->entries);
+  HEAP_FREE(heap->positions);
+  heap->entries = NULL;
+  heap->positions = NULL;
+  heap->size = heap->capacity = heap->handles = 0;
+  heap->free_handle = HEAP_NO_HANDLE;
+}
+
+size_t heap_push(Heap* heap, void* key, void* data) {
+  HeapEntry entry;
+  HeapEntry* entries;
+  size_t capacity;
+
+  if (heap->size == heap->capacity) {
+    capacity = heap->capacity ? 2 * heap->capacity : HEAP_MIN_CAPACITY;
+    entries = HEAP_REALLOC(heap->entries, HeapEntry, capacity);
+    if (!entries) {
+      return HEAP_NO_MEMORY;
+    }
+    heap->entries = entries;
+    heap->capacity = capacity;
+  }
+
+  entry.key = key;
+  entry.data = data;
+  entry.handle = HEAP_NO_HANDLE;
+  if (heap->indexed) {
+    entry.handle = heap_new_handle(heap);
+    if (entry.handle == HEAP_NO_HANDLE) {
+      return HEAP_NO_MEMORY;
+    }
+  }
+
+  heap->size++;
+  heap_sift_up(heap, heap->size - 1, entry);
+  return entry.handle;
+}
+
+void* heap_peek(Heap* heap, const void** key) {
+  if (!heap->size) {
+    if (key) {
+      *key = NULL;
+    }
+    return NULL;
+  }
+  if (key) {
+    *key = heap->entries[0].key;
+  }
+  return heap->entries[0].data;
+}
+
+void* heap_pop(Heap* heap) {
+  HeapEntry entry;
+  if (!heap->size) {
+    return NULL;
+  }
+  entry = heap_take(heap, 0);
+  if (heap->destructor) {
+    heap->destructor(entry.key);
+  }
+  return entry.data;
+}
+
+void heap_update(Heap* heap, size_t handle, void* key) {
+  size_t i = heap->positions[handle];
+  HeapEntry entry = heap->entries[i];
+  int cmp = heap->comparator(key, entry.key);
+
+  if (heap->destructor) {
+    heap->destructor(entry.key);
+  }
+  entry.key = key;
+  if (cmp < 0) {
+    heap_sift_up(heap, i, entry);
+  } else {
+    heap_sift_down(heap, i, entry);
+  }
+}
+
+void* heap_remove(Heap* heap, size_t handle) {
+  HeapEntry entry = heap_take(heap, heap->positions[handle]);
+  if (heap->destructor) {
+    heap->destructor(entry.key);
+  }
+  return entry.data;
+}
+
+size_t heap_size(Heap* heap) {
+  return heap->size;
+}
+
+static HeapEntry heap_take(Heap* heap, size_t i) {
+  HeapEntry entry = heap->entries[i];
+  HeapEntry last = heap->entries[--heap->size];
+
+  if (heap->indexed) {
+    /* chain the handle in the free list */
+    heap->positions[entry.handle] = heap->free_handle;
+    heap->free_handle = entry.handle;
+  }
+
+  /* the last entry fills the hole, in either direction */
+  if (i == 0 && heap->size) {
+    heap_sift_bottom_up(heap, last);
+  } else if (i < heap->size) {
+    if (i > 0 && heap->comparator(last.key,
+                                  heap->entries[(i - 1) / HEAP_ARITY].key) < 0) {
+      heap_sift_up(heap, i, last);
+    } else {
+      heap_sift_down(heap, i, last);
+    }
+  }
+  return entry;
+}
+
+static void heap_sift_up(Heap* heap, size_t i, HeapEntry entry) {
+  size_t parent;
+  while (i > 0) {
+    parent = (i - 1) / HEAP_ARITY;
+    if (heap->comparator(entry.key, heap->entries[parent].key) >= 0) {
+      break;
+    }
+    heap_place(heap, i, heap->entries[parent]);
+    i = parent;
+  }
+  heap_place(heap, i, entry);
+}
+
+static void heap_sift_down(Heap* heap, size_t i, HeapEntry entry) {
+  size_t child, last, best;
+  for (;;) {
+    child = HEAP_ARITY * i + 1;
+    if (child >= heap->size) {
+      break;
+    }
+    /* smallest of the children */
+    last = child + HEAP_ARITY < heap->size ? child + HEAP_ARITY : heap->size;
+    best = child;
+    for (child++; child < last; child++) {
+      if (heap->comparator(heap->entries[child].key,
+                           heap->entries[best].key) < 0) {
+        best = child;
+      }
+    }
+    if (heap->comparator(heap->entries[best].key, entry.key) >= 0) {
+      break;
+    }
+    heap_place(heap, i, heap->entries[best]);
+    i = best;
+  }
+  heap_place(heap, i, entry);
+}
+
+static void heap_sift_bottom_up(Heap* heap, HeapEntry entry) {
+  size_t i = 0, child, last, best;
+  /* entry is likely to end near the bottom, so move the hole down to a leaf
+   * without comparing with entry, then move entry up from there */
+  for (;;) {
+    child = HEAP_ARITY * i + 1;
+    if (child >= heap->size) {
+      break;
+    }
+    last = child + HEAP_ARITY < heap->size ? child + HEAP_ARITY : heap->size;
+    best = child;
+    for (child++; child < last; child++) {
+      if (heap->comparator(heap->entries[child].key,
+                           heap->entries[best].key) < 0) {
+        best = child;
+      }
+    }
+    heap_place(heap, i, heap->entries[best]);
+    i = best;
+  }
+  heap_sift_up(heap, i, entry);
+}
+
+static void heap_place(Heap* heap, size_t i, HeapEntry entry) {
+  heap->entries[i] = entry;
+  if (heap->indexed) {
+    heap->positions[entry.handle] = i;
+  }
+}
+
+static size_t heap_new_handle(Heap* heap) {
+  size_t handle, handles;
+  size_t* positions;
+
+  if (heap->free_handle != HEAP_NO_HANDLE) {
+    handle = heap->free_handle;
+    heap->free_handle = heap->positions[handle];
+    return handle;
+  }
+
+  /* every handle up to heap->handles is used */
+  handles = heap->handles ? 2 * heap->handles : HEAP_MIN_CAPACITY;
+  positions = HEAP_REALLOC(heap->positions, size_t, handles);
+  if (!positions) {
+    return HEAP_NO_HANDLE;
+  }
+  heap->positions = positions;
+  for (handle = handles - 1; handle > heap->handles; handle--) {
+    heap->positions[handle] = heap->free_handle;
+    heap->free_handle = handle;
+  }
+  handle = heap->handles;
+  heap->handles = handles;
+  return handle;
+}
+#endif /* HEAP_IMPLEMENTATION */
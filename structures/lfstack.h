@@ -0,0 +1,227 @@
+/*--------------------------------------------------------------------------*\
+ * Lock-free stack implementation by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Stack that any number of threads can push to and pop from, typically to
+ * share a free list of buffers between threads (Treiber stack).
+ *
+ * The stack is intrusive: users push StkElem they own, usually embedded at
+ * the start of their buffers, and the stack never allocates. An element may
+ * still be read by a concurrent pop after it was popped, so the memory of
+ * elements must stay valid while the stack is in use (recycle them, do not
+ * free them).
+ *
+ * The top of the stack is swapped together with a tag incremented by each
+ * modification, with a double width compare and swap, so that an element
+ * popped and pushed again between the read and the swap of another pop is
+ * noticed (ABA problem). The top and the tag are read as two plain words,
+ * the tag first: if the swap succeeds, the tag did not change since it was
+ * read, so neither did the top.
+ *
+ * On x86_64, compile with -mcx16 (every x86_64 cpu but the very first ones
+ * has cmpxchg16b): the swap is then inlined as lock cmpxchg16b and the
+ * stack is lock-free. Otherwise, and on other targets, the swap is a call to
+ * libatomic (link with -latomic), which may fall back to a lock.
+ *
+ * When the swap fails because of contention, a push offers its element in a
+ * random slot of an elimination array for a little while, and a pop looks
+ * for such an offer, so that opposite operations cancel out without
+ * touching the top of the stack.
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if LFS_IMPLEMENTATION
+ * is defined.
+ * Jump to LFS_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef LFS_H
+#define LFS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// number of elimination slots
+#ifndef LFS_ELIMINATION
+#define LFS_ELIMINATION 8
+#endif
+// polls of a slot while offering an element
+#ifndef LFS_SPINS
+#define LFS_SPINS 128
+#endif
+#define LFS_CACHE_LINE 64
+
+typedef struct StkElem {
+  void* data;
+  _Atomic(struct StkElem*) next;
+} StkElem;
+
+// value of the top of the stack and its tag
+typedef struct {
+  StkElem* top;
+  uintptr_t tag;
+} LfsHead;
+
+typedef struct {
+  _Alignas(LFS_CACHE_LINE) _Atomic(StkElem*) elem;
+} LfsSlot;
+
+typedef struct {
+  // swapped together as an LfsHead, read one at a time
+  _Alignas(LFS_CACHE_LINE) _Atomic(StkElem*) top;
+  atomic_uintptr_t tag;
+  LfsSlot slots[LFS_ELIMINATION];
+} LfStack;
+
+void lfs_initialize(LfStack* );
+void lfs_push(LfStack* , StkElem* elem);
+// Return NULL if the stack is empty
+StkElem* lfs_pop(LfStack* );
+bool lfs_empty(LfStack* );
+
+#endif
+
+#ifdef LFS_IMPLEMENTATION
+
+#include <string.h>
+
+// marks a slot whose element was taken, never a valid element
+#define LFS_TAKEN(stack) ((StkElem*)(stack))
+
+// Read the tag, then the top, see the header comment
+static LfsHead lfs_head(LfStack* stack) {
+  LfsHead head;
+  head.tag = atomic_load_explicit(&stack->tag, memory_order_acquire);
+  head.top = atomic_load_explicit(&stack->top, memory_order_acquire);
+  return head;
+}
+
+// Replace the top and the tag if they are still head, full barrier
+static bool lfs_swap(LfStack* stack, LfsHead head, LfsHead next) {
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) && UINTPTR_MAX == UINT64_MAX
+  __extension__ typedef unsigned __int128 lfs_u128;
+  lfs_u128 expected, desired;
+  memcpy(&expected, &head, sizeof(expected));
+  memcpy(&desired, &next, sizeof(desired));
+  return __sync_bool_compare_and_swap((lfs_u128*)(void*)&stack->top,
+                                      expected, desired);
+#else
+  return __atomic_compare_exchange((LfsHead*)(void*)&stack->top, &head,
+                                   &next, false, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED);
+#endif
+}
+
+// Pick an elimination slot at random
+static LfsSlot* lfs_slot(LfStack* stack) {
+  static _Thread_local uint32_t x = 0;
+  if (!x) {
+    x = (uint32_t)(uintptr_t)&x | 1;
+  }
+  // xorshift32
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return &stack->slots[x % LFS_ELIMINATION];
+}
+
+// Offer elem to a pop for a while, return true if it was taken
+static bool lfs_offer(LfStack* stack, StkElem* elem) {
+  LfsSlot* slot = lfs_slot(stack);
+  StkElem* expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(
+        &slot->elem, &expected, elem,
+        memory_order_release, memory_order_relaxed)) {
+    return false;
+  }
+
+  for (int i = 0; i < LFS_SPINS; i++) {
+    if (atomic_load_explicit(&slot->elem, memory_order_relaxed) != elem) {
+      break;
+    }
+  }
+
+  expected = elem;
+  if (atomic_compare_exchange_strong_explicit(
+        &slot->elem, &expected, NULL,
+        memory_order_relaxed, memory_order_relaxed)) {
+    // withdrawn
+    return false;
+  }
+  // only the offering push frees a taken slot
+  atomic_store_explicit(&slot->elem, NULL, memory_order_relaxed);
+  return true;
+}
+
+// Take an offered element, if any
+static StkElem* lfs_take(LfStack* stack) {
+  LfsSlot* slot = lfs_slot(stack);
+  StkElem* elem = atomic_load_explicit(&slot->elem, memory_order_relaxed);
+  if (!elem || elem == LFS_TAKEN(stack)) {
+    return NULL;
+  }
+  if (atomic_compare_exchange_strong_explicit(
+        &slot->elem, &elem, LFS_TAKEN(stack),
+        memory_order_acquire, memory_order_relaxed)) {
+    return elem;
+  }
+  return NULL;
+}
+
+void lfs_initialize(LfStack* stack) {
+  atomic_init(&stack->top, NULL);
+  atomic_init(&stack->tag, 0);
+  for (int i = 0; i < LFS_ELIMINATION; i++) {
+    atomic_init(&stack->slots[i].elem, NULL);
+  }
+}
+
+void lfs_push(LfStack* stack, StkElem* elem) {
+  LfsHead head = lfs_head(stack);
+  LfsHead top;
+  for (;;) {
+    atomic_store_explicit(&elem->next, head.top, memory_order_relaxed);
+    top.top = elem;
+    top.tag = head.tag + 1;
+    if (lfs_swap(stack, head, top)) {
+      return;
+    }
+    if (lfs_offer(stack, elem)) {
+      return;
+    }
+    head = lfs_head(stack);
+  }
+}
+
+StkElem* lfs_pop(LfStack* stack) {
+  LfsHead head = lfs_head(stack);
+  LfsHead next;
+  StkElem* elem;
+  for (;;) {
+    if (!head.top) {
+      return NULL;
+    }
+    // head.top may be popped and pushed again meanwhile, then the tag
+    // changed and the swap fails
+    next.top = atomic_load_explicit(&head.top->next, memory_order_relaxed);
+    next.tag = head.tag + 1;
+    if (lfs_swap(stack, head, next)) {
+      return head.top;
+    }
+    if ((elem = lfs_take(stack))) {
+      return elem;
+    }
+    head = lfs_head(stack);
+  }
+}
+
+bool lfs_empty(LfStack* stack) {
+  return !atomic_load_explicit(&stack->top, memory_order_relaxed);
+}
+
+#endif // LFS_IMPLEMENTATION
@@ -0,0 +1,635 @@
+/*--------------------------------------------------------------------------*\
+ * Persistent AVL tree by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Same algorithms as structures/avl.h, but a modification never changes a
+ * node that can be seen by a reader: only the O(log(n)) nodes on the path
+ * are copied and a new root is published atomically. Readers take a
+ * snapshot of the tree and traverse it without any lock while the writer
+ * goes on.
+ *
+ * Nodes are reference counted (one reference per parent and per snapshot),
+ * so a node is freed by the last thread to release it. Keys are shared by
+ * all the copies of a node and destroyed with the last of them.
+ * The root is acquired through a two phase epoch: the writer waits, after
+ * publishing a new root, for the readers that may still be reading the
+ * previous one to have taken their reference. This wait is only a few
+ * instructions long and never depends on how long a snapshot is kept.
+ *
+ * Warning: there can be only one writer at a time (pavl_insert,
+ * pavl_remove, pavl_destroy), but any number of readers (pavl_snapshot,
+ * pavl_release, pavl_snapshot_search, pavl_visit, pavl_search).
+ *
+ * Same key managment contract as avl.h:
+ * - user MUST allocate keys
+ * - user MUST NOT destroy key
+ * - pavl_ MUST destroy keys when they are not needed anymore
+ * Keys may be destroyed by a reader thread releasing the last snapshot
+ * holding them.
+ *
+ * Data returned by pavl_insert and pavl_remove may still be visible in
+ * snapshots taken before the modification.
+ *
+ * Requires C11 atomics.
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if PAVL_IMPLEMENTATION
+ * is defined.
+ * Jump to PAVL_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef PAVL_H
+#define PAVL_H
+
+/* memory allocation macros, change as necessary */
+#define PAVL_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define PAVL_FREE(variable) free(variable)
+#include <stdlib.h> /* for malloc() */
+#include <stdint.h>
+#include <stdatomic.h>
+
+typedef int (*pavl_comparator_f)(const void* key1, const void* key2);
+typedef void (*pavl_key_destructor_f)(void* key);
+typedef void (*pavl_node_visitor_f)(const void* key, void* data);
+
+/* shared by all the copies of a node */
+typedef struct PavlKey {
+  atomic_size_t refs;
+  void* key;
+} PavlKey;
+
+typedef struct PavlNode {
+  struct PavlNode* left,* right;
+  int depth;
+
+  atomic_size_t refs;
+  /* write in which the node was created, it can only be modified during
+   * this write */
+  uint64_t gen;
+
+  void* key;
+  void* data;
+  PavlKey* owner;
+} PavlNode;
+
+/* a snapshot is a referenced root, NULL is the empty tree */
+typedef PavlNode* PavlSnapshot;
+
+typedef struct {
+  _Atomic(PavlNode*) root;
+  pavl_comparator_f comparator;
+  pavl_key_destructor_f destructor;
+
+  atomic_uint epoch;
+  atomic_size_t readers[2];
+  uint64_t gen;
+} PavlTree;
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_initialize() - initialize a new tree
+ *  DESCRIPTION:
+ *      Initialize a tree. The user have to own the memory corresponding to the
+ *      tree. It should be cleand with pavl_destroy.
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to initialize
+ *      comparator  - a pavl_comparator_f function pointer ((void*, void*) -> int) to
+ *                    compare keys
+ *      destructor  - a pavl_key_destructor_f function pointer (void* -> void) to
+ *                    destroy keys
+\*--------------------------------------------------------------------------*/
+void pavl_initialize(PavlTree* tree,
+                     pavl_comparator_f comparator,
+                     pavl_key_destructor_f destructor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_destroy() - destroy a tree
+ *  DESCRIPTION:
+ *      Every snapshot must have been released before.
+ *  ARGUMENTS:
+ *      tree        - a pointer to the tree to destroy
+ *      visitor     - a pavl_node_visitor_f function pointer ((void *key, void *data) -> void)
+ *                    Applied on each key-value pair of the current version
+ *                    before destroying it. Use it for your own cleanup of the
+ *                    data.
+ *                    visitor should NOT free the key.
+ *                    Use NULL when you don't want the data to be freed.
+ *                    The tree will be freed anyway.
+\*--------------------------------------------------------------------------*/
+void pavl_destroy(PavlTree* tree, pavl_node_visitor_f visitor);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_insert() - insert a key-value pair
+ *  DESCRIPTION:
+ *      If the key is already present, replace the value with the new data
+ *      and return a pointer to the old data.
+ *      Else insert the data and return NULL.
+ *      Anyway the key memory is no longer yours, it may be freed or used,
+ *      consider that you should forget about it.
+ *      The new version is visible to snapshots taken after the return.
+ *  EFFICIENCY:
+ *      O(log(n)) time and new nodes
+\*--------------------------------------------------------------------------*/
+void* pavl_insert(PavlTree* tree, void* key, void* data);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_remove() - remove a key-value pair
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, remove it from the tree and
+ *      return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *      The new version is visible to snapshots taken after the return.
+ *  EFFICIENCY:
+ *      O(log(n)) time and new nodes
+\*--------------------------------------------------------------------------*/
+void* pavl_remove(PavlTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_snapshot() - take a snapshot of the current version
+ *  DESCRIPTION:
+ *      Return a consistent and immutable view of the tree. It must be given
+ *      back with pavl_release. Never blocks, it only retries if a write
+ *      is published in the meantime.
+ *  EFFICIENCY:
+ *      O(1)
+\*--------------------------------------------------------------------------*/
+PavlSnapshot pavl_snapshot(PavlTree* tree);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_release() - release a snapshot
+ *  DESCRIPTION:
+ *      Free the nodes that are only present in this snapshot.
+ *  EFFICIENCY:
+ *      O(1), plus O(k) to free the k nodes only present in this snapshot
+ *      when it was the last reference to them.
+\*--------------------------------------------------------------------------*/
+void pavl_release(PavlTree* tree, PavlSnapshot snapshot);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_snapshot_search() - search for a key in a snapshot
+ *  DESCRIPTION:
+ *      Search for the key and if it is found, return a pointer to the data.
+ *      Return NULL if nothing have been found.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* pavl_snapshot_search(PavlTree* tree, PavlSnapshot snapshot,
+                           const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_search() - search for a key in the current version
+ *  DESCRIPTION:
+ *      Same as pavl_snapshot_search on a temporary snapshot.
+ *  EFFICIENCY:
+ *      O(log(n))
+\*--------------------------------------------------------------------------*/
+void* pavl_search(PavlTree* tree, const void* key);
+
+/*--------------------------------------------------------------------------*\
+ *  NAME:
+ *      pavl_visit() - visit a snapshot in order
+ *  DESCRIPTION:
+ *      Apply visitor on each key-value pair of the snapshot in increasing
+ *      key order. visitor should NOT free the key.
+ *  EFFICIENCY:
+ *      O(n)
+\*--------------------------------------------------------------------------*/
+void pavl_visit(PavlSnapshot snapshot, pavl_node_visitor_f visitor);
+
+#endif
+
+#ifdef PAVL_IMPLEMENTATION
+/* required definitions */
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+/* drop a reference to a node, free it with the last one */
+static void pavl_node_release(PavlTree* tree, PavlNode* node);
+/* drop a reference to a key, destroy it with the last one */
+static void pavl_key_release(PavlTree* tree, PavlKey* owner);
+/* find the node holding key in the subtree */
+static PavlNode* pavl_find(PavlTree* tree, PavlNode* node, const void* key);
+/* make the node in slot modifiable during the current write, copying it
+ * if it is visible from a published version */
+static PavlNode* pavl_mutable(PavlTree* tree, PavlNode** slot);
+/* publish a new root and release the previous one */
+static void pavl_publish(PavlTree* tree, PavlNode* root);
+/* recursive destruction helper */
+static void pavl_destroy_helper(PavlNode* node, pavl_node_visitor_f visitor);
+/* recursive insertion helper */
+static void* pavl_insert_helper(PavlTree* tree,
+                                PavlNode** node, void* key, void* data);
+/* recursive removal helper, finds the appropriate node to remove */
+static void* pavl_remove_helper(PavlTree* tree,
+                                PavlNode** node, const void* key);
+/* recursive removal helper, detach the maximum node of a subtree */
+static void pavl_pop_max(PavlTree* tree, PavlNode** node,
+                         void** key, void** data, PavlKey** owner);
+
+#define PAVL_LEFT 0
+#define PAVL_RIGHT 1
+/* rotates a node and its left/right child as appropriate (left=0, right=1) */
+static void pavl_rotate(PavlTree* tree, PavlNode** ptr, int which);
+
+/* performs rotations to appropriately rebalance a node and its children */
+static void pavl_rebalance(PavlTree* tree, PavlNode** ptr);
+/* calculates how out-of-balance a node is (>0 if left deeper) */
+static int pavl_balance_factor(PavlNode* ptr);
+/* recalculates the depth of a node */
+static void pavl_update_depth(PavlNode* ptr);
+
+void pavl_initialize(PavlTree* tree, pavl_comparator_f comparator,
+                     pavl_key_destructor_f destructor) {
+
+  tree->comparator = comparator;
+  tree->destructor = destructor;
+  atomic_init(&tree->root, NULL);
+  atomic_init(&tree->epoch, 0);
+  atomic_init(&tree->readers[0], 0);
+  atomic_init(&tree->readers[1], 0);
+  tree->gen = 0;
+}
+
+void pavl_destroy(PavlTree* tree, pavl_node_visitor_f visitor) {
+  PavlNode* root = atomic_load(&tree->root);
+  if (visitor) {
+    pavl_destroy_helper(root, visitor);
+  }
+  atomic_store(&tree->root, NULL);
+  pavl_node_release(tree, root);
+}
+
+static void pavl_destroy_helper(PavlNode* node, pavl_node_visitor_f visitor) {
+  if (node == NULL) {
+    return;
+  }
+  visitor(node->key, node->data);
+  pavl_destroy_helper(node->left, visitor);
+  pavl_destroy_helper(node->right, visitor);
+}
+
+static void pavl_node_release(PavlTree* tree, PavlNode* node) {
+  PavlNode* next;
+  while (node && atomic_fetch_sub(&node->refs, 1) == 1) {
+    if (node->owner) {
+      pavl_key_release(tree, node->owner);
+    }
+    /* loop on one side instead of recursing */
+    pavl_node_release(tree, node->left);
+    next = node->right;
+    PAVL_FREE(node);
+    node = next;
+  }
+}
+
+static void pavl_key_release(PavlTree* tree, PavlKey* owner) {
+  if (atomic_fetch_sub(&owner->refs, 1) == 1) {
+    if (tree->destructor) {
+      tree->destructor(owner->key);
+    }
+    PAVL_FREE(owner);
+  }
+}
+
+static PavlNode* pavl_mutable(PavlTree* tree, PavlNode** slot) {
+  PavlNode* node = *slot;
+  PavlNode* copy;
+
+  if (node->gen == tree->gen) {
+    return node;
+  }
+
+  PAVL_ALLOC(copy, PavlNode);
+  copy->left = node->left;
+  copy->right = node->right;
+  copy->depth = node->depth;
+  copy->key = node->key;
+  copy->data = node->data;
+  copy->owner = node->owner;
+  copy->gen = tree->gen;
+  atomic_init(&copy->refs, 1);
+
+  /* the copy references the same children and key */
+  if (copy->left) {
+    atomic_fetch_add(&copy->left->refs, 1);
+  }
+  if (copy->right) {
+    atomic_fetch_add(&copy->right->refs, 1);
+  }
+  atomic_fetch_add(&copy->owner->refs, 1);
+
+  /* and the slot references the copy instead of the original */
+  *slot = copy;
+  pavl_node_release(tree, node);
+  return copy;
+}
+
+static void pavl_publish(PavlTree* tree, PavlNode* root) {
+  PavlNode* old = atomic_load(&tree->root);
+  unsigned epoch;
+
+  atomic_store(&tree->root, root);
+  /* readers registered in the previous epoch may have loaded the old root
+   * but not yet taken their reference. Newer readers see the new root. */
+  epoch = atomic_fetch_add(&tree->epoch, 1);
+  while (atomic_load(&tree->readers[epoch & 1])) {
+    /* spin, readers only stay registered for a few instructions */
+  }
+  pavl_node_release(tree, old);
+}
+
+PavlSnapshot pavl_snapshot(PavlTree* tree) {
+  PavlNode* root;
+  unsigned epoch;
+
+  for (;;) {
+    epoch = atomic_load(&tree->epoch);
+    atomic_fetch_add(&tree->readers[epoch & 1], 1);
+    if (atomic_load(&tree->epoch) == epoch) {
+      break;
+    }
+    /* a writer moved on, it may not wait for this counter */
+    atomic_fetch_sub(&tree->readers[epoch & 1], 1);
+  }
+
+  root = atomic_load(&tree->root);
+  if (root) {
+    atomic_fetch_add(&root->refs, 1);
+  }
+  atomic_fetch_sub(&tree->readers[epoch & 1], 1);
+  return root;
+}
+
+void pavl_release(PavlTree* tree, PavlSnapshot snapshot) {
+  pavl_node_release(tree, snapshot);
+}
+
+static PavlNode* pavl_find(PavlTree* tree, PavlNode* node, const void* key) {
+  int cmp;
+  while (node) {
+    cmp = tree->comparator(key, node->key);
+    if (cmp == 0) {
+      return node;
+    } else if (cmp < 0) {
+      node = node->left;
+    } else {  /* if(cmp > 0) */
+      node = node->right;
+    }
+  }
+  return NULL;
+}
+
+void* pavl_snapshot_search(PavlTree* tree, PavlSnapshot snapshot,
+                           const void* key) {
+  PavlNode* node = pavl_find(tree, snapshot, key);
+  return node ? node->data : NULL;
+}
+
+void* pavl_search(PavlTree* tree, const void* key) {
+  PavlSnapshot snapshot = pavl_snapshot(tree);
+  void* data = pavl_snapshot_search(tree, snapshot, key);
+  pavl_release(tree, snapshot);
+  return data;
+}
+
+void pavl_visit(PavlSnapshot snapshot, pavl_node_visitor_f visitor) {
+  while (snapshot) {
+    pavl_visit(snapshot->left, visitor);
+    visitor(snapshot->key, snapshot->data);
+    snapshot = snapshot->right;
+  }
+}
+
+void* pavl_insert(PavlTree* tree, void* key, void* data) {
+  PavlNode* root = atomic_load(&tree->root);
+  void* ret;
+
+  tree->gen++;
+  /* the new version references the current root until it is copied */
+  if (root) {
+    atomic_fetch_add(&root->refs, 1);
+  }
+  ret = pavl_insert_helper(tree, &root, key, data);
+  pavl_publish(tree, root);
+  return ret;
+}
+
+static void* pavl_insert_helper(PavlTree* tree,
+                                PavlNode** node, void* key, void* data) {
+
+  int cmp;
+  void* ret;
+  PavlNode* n;
+
+  /* if the search leads us to an empty location, then add the new node.
+   * rebalancing, if required, will be handled by the parent call in the
+   * recursion. */
+  if (!*node) {
+    PAVL_ALLOC(n, PavlNode);
+    PAVL_ALLOC(n->owner, PavlKey);
+    atomic_init(&n->owner->refs, 1);
+    n->owner->key = key;
+    atomic_init(&n->refs, 1);
+    n->gen = tree->gen;
+    n->depth = 1;
+    n->key = key;
+    n->data = data;
+    n->left = n->right = NULL;
+    *node = n;
+
+    return NULL;
+  }
+
+  cmp = tree->comparator(key, (*node)->key);
+  n = pavl_mutable(tree, node);
+  if (cmp == 0) {
+    /* if we find a node with the same value, then replace the contents. */
+    void* old = n->data;
+    n->data = data;
+    /* we don't need the new key any more. */
+    if (tree->destructor) {
+      tree->destructor(key);
+    }
+    return old;
+  } else if (cmp < 0) {
+    ret = pavl_insert_helper(tree, &n->left, key, data);
+  } else {  /*if(cmp > 0) */
+    ret = pavl_insert_helper(tree, &n->right, key, data);
+  }
+
+  /* check, and rebalance the current node, if necessary */
+  pavl_rebalance(tree, node);
+  /* ensure the depth of this node is correct */
+  pavl_update_depth(*node);
+
+  return ret;
+}
+
+void* pavl_remove(PavlTree* tree, const void* key) {
+  PavlNode* root = atomic_load(&tree->root);
+  void* ret;
+
+  /* do not copy anything if the key is absent */
+  if (!pavl_find(tree, root, key)) {
+    return NULL;
+  }
+
+  tree->gen++;
+  atomic_fetch_add(&root->refs, 1);
+  ret = pavl_remove_helper(tree, &root, key);
+  pavl_publish(tree, root);
+  return ret;
+}
+
+static void* pavl_remove_helper(PavlTree* tree,
+                                PavlNode** node, const void* key) {
+
+  int cmp;
+  void* ret;
+  PavlNode* n;
+
+  /* if we didn't find the node, then, well . . . */
+  if (!*node) {
+    return NULL;
+  }
+
+  cmp = tree->comparator(key, (*node)->key);
+  n = pavl_mutable(tree, node);
+
+  if (cmp < 0) {
+    ret = pavl_remove_helper(tree, &n->left, key);
+  } else if (cmp > 0) {
+    ret = pavl_remove_helper(tree, &n->right, key);
+  } else {  /* if(cmp == 0) */
+    /* node found. */
+    PavlNode* p;
+    PavlKey* owner;
+
+    ret = n->data;
+
+    if (n->left && n->right) {
+      /* use maximum node in left subtree as the replacement */
+      owner = n->owner;
+      pavl_pop_max(tree, &n->left, &n->key, &n->data, &n->owner);
+      /* the key is destroyed when older versions are done with it */
+      pavl_key_release(tree, owner);
+    } else {
+      /* replace this node with its only subtree, if any, the reference
+       * on the subtree is moved to the slot */
+      p = n->left ? n->left : n->right;
+      n->left = n->right = NULL;
+      *node = p;
+      pavl_node_release(tree, n);
+      /* the subtree is published and already balanced */
+      return ret;
+    }
+  }
+
+  /* if the node was replaced, ensure the depth is correct and that
+   * everything is balanced */
+  if (*node) {
+    pavl_update_depth(*node);
+    pavl_rebalance(tree, node);
+  }
+
+  return ret;
+}
+
+static void pavl_pop_max(PavlTree* tree, PavlNode** node,
+                         void** key, void** data, PavlKey** owner) {
+  PavlNode* n = pavl_mutable(tree, node);
+
+  if (n->right) {
+    pavl_pop_max(tree, &n->right, key, data, owner);
+    pavl_update_depth(n);
+    pavl_rebalance(tree, node);
+    return;
+  }
+
+  /* the references on the key and the left subtree are moved */
+  *key = n->key;
+  *data = n->data;
+  *owner = n->owner;
+  *node = n->left;
+  n->owner = NULL;
+  n->left = NULL;
+  pavl_node_release(tree, n);
+}
+
+static void pavl_rebalance(PavlTree* tree, PavlNode** node) {
+  int delta = pavl_balance_factor(*node);
+
+  /* two rotation directions */
+  if (delta == 2) {
+    if (pavl_balance_factor((*node)->left) < 0) {
+      pavl_rotate(tree, &(*node)->left, PAVL_LEFT);
+    }
+    pavl_rotate(tree, node, PAVL_RIGHT);
+  } else if (delta == -2) {
+    if (pavl_balance_factor((*node)->right) > 0) {
+      pavl_rotate(tree, &(*node)->right, PAVL_RIGHT);
+    }
+    pavl_rotate(tree, node, PAVL_LEFT);
+  }
+}
+
+static void pavl_rotate(PavlTree* tree, PavlNode** node, int dir) {
+  PavlNode* ch;
+
+  /* both nodes are modified, so none of them may be published. */
+  pavl_mutable(tree, node);
+
+  /* standard tree rotations, references are only moved around */
+  if (dir == PAVL_LEFT) {
+    ch = pavl_mutable(tree, &(*node)->right);
+
+    (*node)->right = ch->left;
+    ch->left = *node;
+    pavl_update_depth(*node);
+    *node = ch;
+  } else {
+    ch = pavl_mutable(tree, &(*node)->left);
+
+    (*node)->left = ch->right;
+    ch->right = *node;
+    pavl_update_depth(*node);
+    *node = ch;
+  }
+  pavl_update_depth(*node);
+}
+
+static int pavl_balance_factor(PavlNode* ptr) {
+  int delta = 0;
+  if (ptr->left) {
+    delta = ptr->left->depth;
+  }
+  if (ptr->right) {
+    delta -= ptr->right->depth;
+  }
+  return delta;
+}
+
+static void pavl_update_depth(PavlNode* ptr) {
+  ptr->depth = 0;
+  if (ptr->left) {
+    ptr->depth = ptr->left->depth;
+  }
+  if (ptr->right && ptr->depth < ptr->right->depth) {
+    ptr->depth = ptr->right->depth;
+  }
+  ptr->depth++;
+}
+#endif /* PAVL_IMPLEMENTATION */
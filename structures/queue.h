@@ -4,12 +4,17 @@
  * To the extent possible under law, the author has dedicated all copyright
  * and related and neighboring rights to this software to the public domain
  * worldwide. This software is distributed without any warranty.
- * 
+ *
  * See <http://creativecommons.org/publicdomain/zero/1.0/>.
  *
  * This file implements one of the simplest yet most useful data structure.
  * Anyone can write this, but I don't want to have to anymore.
- * 
+ *
+ * The elements are stored in a ring buffer whose capacity is a power of two
+ * and doubles when full, so both ends work in O(1) and do not allocate in
+ * steady state. A zeroed Queue is an empty queue, q_destroy releases the
+ * buffer.
+ *
  * By default this file is only a header.
  * The implementation of functions is added only if Q_IMPLEMENTATION
  * is defined.
@@ -19,64 +24,117 @@
 #ifndef Q_H
 #define Q_H
 
-#define Q_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define Q_ALLOC_N(variable, type, n) \
+  variable = (type *)malloc((n) * sizeof(type))
 #define Q_FREE(variable) free(variable)
 #include <stdlib.h> /* for malloc() */
+#include <stdbool.h>
+#include <stdint.h> /* for SIZE_MAX */
 
-typedef struct QElem {
-  void* data;
-  struct QElem* next;
-} QElem;
+// capacity of the first allocation, a power of two
+#define Q_MIN_CAPACITY 16
 
 typedef struct {
-  QElem* head;
-  QElem* tip;
+  void** elems;
+  // index of the first element
+  size_t head;
+  size_t size;
+  size_t capacity;
 } Queue;
 
-void q_push(Queue* , void* data);
-void q_unshift(Queue* , void* data);
+// Return false if the buffer could not be grown
+bool q_push(Queue* , void* data);
+bool q_unshift(Queue* , void* data);
 void* q_shift(Queue* );
-void* q_empty(Queue* );
+void* q_pop(Queue* );
+bool q_empty(Queue* );
+
+// Make room for n more elements, return false if allocation failed
+bool q_reserve(Queue* , size_t n);
+// Release the buffer, the queue is empty afterward
+void q_destroy(Queue* );
 
 #endif
 
 #ifdef Q_IMPLEMENTATION
 
+bool q_reserve(Queue* queue, size_t n) {
+  if (queue->capacity - queue->size >= n) {
+    return true;
+  }
+  size_t capacity = queue->capacity ? queue->capacity : Q_MIN_CAPACITY;
+  while (capacity - queue->size < n) {
+    if (capacity > SIZE_MAX / 2 / sizeof(void*)) {
+      return false;
+    }
+    capacity *= 2;
+  }
+
+  void** elems;
+  Q_ALLOC_N(elems, void*, capacity);
+  if (!elems) {
+    return false;
+  }
+  // unwrap the elements at the start of the new buffer
+  for (size_t i = 0; i < queue->size; i++) {
+    elems[i] = queue->elems[(queue->head + i) & (queue->capacity - 1)];
+  }
+  Q_FREE(queue->elems);
+  queue->elems = elems;
+  queue->head = 0;
+  queue->capacity = capacity;
+  return true;
+}
+
 // Insert data at the begining
-void q_push(Queue* queue, void* data) {
-  QElem* elem = Q_ALLOC(QElem);
-  elem->data = data;
-  elem->next = queue->head;
-  queue->head = elem;
+bool q_push(Queue* queue, void* data) {
+  if (queue->size == queue->capacity && !q_reserve(queue, 1)) {
+    return false;
+  }
+  queue->head = (queue->head - 1) & (queue->capacity - 1);
+  queue->elems[queue->head] = data;
+  queue->size++;
+  return true;
 }
 
 // Insert data at the end
-void q_unshift(Queue* queue, void* data) {
-  QElem* elem = Q_ALLOC(QElem);
-  elem->data = data;
-  if (!queue->head) {
-    elem->next = NULL;
-    queue->head = elem;
-  } else {
-    queue->tip->next = elem;
+bool q_unshift(Queue* queue, void* data) {
+  if (queue->size == queue->capacity && !q_reserve(queue, 1)) {
+    return false;
   }
-  queue->tip = elem;
+  queue->elems[(queue->head + queue->size) & (queue->capacity - 1)] = data;
+  queue->size++;
+  return true;
 }
 
 // Remove data from the begining and return it
 void* q_shift(Queue* queue) {
-  if (!queue->head) {
+  if (!queue->size) {
     return NULL;
   }
-  QElem* elem = queue->head;
-  queue->head = elem->next;
-  void* data = elem->data;
-  Q_FREE(elem);
+  void* data = queue->elems[queue->head];
+  queue->head = (queue->head + 1) & (queue->capacity - 1);
+  queue->size--;
   return data;
 }
 
+// Remove data from the end and return it
+void* q_pop(Queue* queue) {
+  if (!queue->size) {
+    return NULL;
+  }
+  queue->size--;
+  return queue->elems[(queue->head + queue->size) & (queue->capacity - 1)];
+}
+
 bool q_empty(Queue* queue) {
-  return !queue->head;
+  return !queue->size;
+}
+
+void q_destroy(Queue* queue) {
+  Q_FREE(queue->elems);
+  queue->elems = NULL;
+  queue->head = queue->size = queue->capacity = 0;
 }
 
 #endif // Q_IMPLEMENTATION
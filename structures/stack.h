@@ -4,12 +4,16 @@
  * To the extent possible under law, the author has dedicated all copyright
  * and related and neighboring rights to this software to the public domain
  * worldwide. This software is distributed without any warranty.
- * 
+ *
  * See <http://creativecommons.org/publicdomain/zero/1.0/>.
  *
  * This file implements one of the simplest yet most useful data structure.
  * Anyone can write this, but I don't want to have to anymore.
- * 
+ *
+ * The elements are stored in an array that doubles when full, so pushing
+ * and popping do not allocate in steady state. A zeroed Stack is an empty
+ * stack, stk_destroy releases the array.
+ *
  * By default this file is only a header.
  * The implementation of functions is added only if STK_IMPLEMENTATION
  * is defined.
@@ -19,47 +23,104 @@
 #ifndef STK_H
 #define STK_H
 
-#define STK_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define STK_REALLOC(variable, type, n) \
+  (type *)realloc(variable, (n) * sizeof(type))
 #define STK_FREE(variable) free(variable)
-#include <stdlib.h> /* for malloc() */
+#include <stdlib.h> /* for realloc() */
 #include <stdbool.h>
+#include <stdint.h> /* for SIZE_MAX */
 
-typedef struct StkElem {
-  void* data;
-  struct StkElem* next;
-} StkElem;
+// capacity of the first allocation
+#define STK_MIN_CAPACITY 16
 
 typedef struct {
-  StkElem* head;
+  void** elems;
+  size_t size;
+  size_t capacity;
 } Stack;
 
-void stk_push(Stack* , void* data);
+// Return false if the array could not be grown
+bool stk_push(Stack* , void* data);
 void* stk_pop(Stack* );
 bool stk_empty(Stack* );
 
+// Make room for n more elements, return false if allocation failed
+bool stk_reserve(Stack* , size_t n);
+// Push data[0] to data[n - 1], data[n - 1] ends on top
+bool stk_push_n(Stack* , void** data, size_t n);
+// Pop up to n elements, data[0] gets the top, return the number popped
+size_t stk_pop_n(Stack* , void** data, size_t n);
+// Release the array, the stack is empty afterward
+void stk_destroy(Stack* );
+
 #endif
 
 #ifdef STK_IMPLEMENTATION
-void stk_push(Stack* stack, void* data) {
-  StkElem* elem = STK_ALLOC(StkElem);
-  elem->data = data;
-  elem->next = stack->head;
-  stack->head = elem;
+bool stk_reserve(Stack* stack, size_t n) {
+  if (stack->capacity - stack->size >= n) {
+    return true;
+  }
+  size_t capacity = stack->capacity ? stack->capacity : STK_MIN_CAPACITY;
+  while (capacity - stack->size < n) {
+    if (capacity > SIZE_MAX / 2 / sizeof(void*)) {
+      return false;
+    }
+    capacity *= 2;
+  }
+  void** elems = STK_REALLOC(stack->elems, void*, capacity);
+  if (!elems) {
+    return false;
+  }
+  stack->elems = elems;
+  stack->capacity = capacity;
+  return true;
+}
+
+bool stk_push(Stack* stack, void* data) {
+  if (stack->size == stack->capacity && !stk_reserve(stack, 1)) {
+    return false;
+  }
+  stack->elems[stack->size++] = data;
+  return true;
 }
 
 void* stk_pop(Stack* stack) {
-  if (!stack->head) {
+  if (!stack->size) {
     return NULL;
   }
-  StkElem* elem = stack->head;
-  stack->head = elem->next;
-  void* data = elem->data;
-  STK_FREE(elem);
-  return data;
+  return stack->elems[--stack->size];
 }
 
 bool stk_empty(Stack* stack) {
-  return !stack->head;
+  return !stack->size;
+}
+
+bool stk_push_n(Stack* stack, void** data, size_t n) {
+  if (!stk_reserve(stack, n)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    stack->elems[stack->size + i] = data[i];
+  }
+  stack->size += n;
+  return true;
+}
+
+size_t stk_pop_n(Stack* stack, void** data, size_t n) {
+  if (n > stack->size) {
+    n = stack->size;
+  }
+  for (size_t i = 0; i < n; i++) {
+    data[i] = stack->elems[stack->size - 1 - i];
+  }
+  stack->size -= n;
+  return n;
+}
+
+void stk_destroy(Stack* stack) {
+  STK_FREE(stack->elems);
+  stack->elems = NULL;
+  stack->size = stack->capacity = 0;
 }
 
 #endif // STK_IMPLEMENTATION
@@ -0,0 +1,532 @@
+/*--------------------------------------------------------------------------*\
+ * Thread pool implementation by Théo Cavignac (theo.cavignac@gmail.com)
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * See <http://creativecommons.org/publicdomain/zero/1.0/>.
+ *
+ * Work-stealing thread pool for task parallel jobs.
+ *
+ * WsDeque is a Chase-Lev deque (in the C11 formulation of Lê et al., 2013):
+ * its owner pushes and pops at the bottom without locking, other threads
+ * steal at the top, and the array grows when full.
+ *
+ * TpPool gives each worker such a deque. Tasks submitted by a task go to the
+ * deque of its worker, so that related work stays on the same thread, and
+ * tasks submitted from outside go to a shared queue (structures/queue.h
+ * behind a mutex). Idle workers steal from random victims, and sleep when
+ * no task is queued anywhere.
+ *
+ * Waiting on a wait group runs queued tasks instead of blocking, so tasks
+ * can submit and wait for subtasks, as tp_parallel_for does.
+ *
+ * The implementation uses structures/queue.h, whose implementation must be
+ * included once too (define Q_IMPLEMENTATION), and POSIX threads.
+ *
+ * By default this file is only a header.
+ * The implementation of functions is added only if TP_IMPLEMENTATION
+ * is defined.
+ * Jump to TP_IMPLEMENTATION to go to the start of implementation.
+\*--------------------------------------------------------------------------*/
+
+#ifndef TP_H
+#define TP_H
+
+#include <stdlib.h> /* for malloc() */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "queue.h"
+
+#define TP_ALLOC(variable, type) variable = (type *)malloc(sizeof(type))
+#define TP_FREE(variable) free(variable)
+
+// initial capacity of a deque, a power of two
+#define WSD_MIN_CAPACITY 64
+#define TP_CACHE_LINE 64
+
+typedef struct WsdArray {
+  int64_t size;
+  // previous array, thieves may still read it
+  struct WsdArray* prev;
+  _Atomic(void*) items[];
+} WsdArray;
+
+typedef struct {
+  _Alignas(TP_CACHE_LINE) _Atomic int64_t top;
+  _Alignas(TP_CACHE_LINE) _Atomic int64_t bottom;
+  _Atomic(WsdArray*) array;
+} WsDeque;
+
+bool wsd_initialize(WsDeque* );
+void wsd_destroy(WsDeque* );
+// Owner only, data must not be NULL, return false if allocation failed
+bool wsd_push(WsDeque* , void* data);
+// Owner only, take the last pushed item, NULL if empty
+void* wsd_pop(WsDeque* );
+// Any thread, take the first pushed item, NULL if empty or if another
+// thread took it first
+void* wsd_steal(WsDeque* );
+
+typedef void (*tp_task_f)(void* arg);
+typedef void (*tp_range_f)(void* arg, size_t begin, size_t end);
+
+typedef struct {
+  atomic_long count;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} TpWaitGroup;
+
+struct TpPool;
+
+typedef struct {
+  WsDeque deque;
+  struct TpPool* pool;
+  pthread_t thread;
+  uint32_t rng;
+} TpWorker;
+
+typedef struct TpPool {
+  int nworkers;
+  TpWorker* workers;
+
+  // tasks submitted from outside the pool
+  Queue injected;
+  pthread_mutex_t injected_mutex;
+
+  // tasks queued and not yet taken
+  _Alignas(TP_CACHE_LINE) atomic_long pending;
+  atomic_int sleeping;
+  atomic_int stop;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} TpPool;
+
+// Start nthreads workers, or one per processor if nthreads <= 0. On failure
+// return false with nothing left allocated or running
+bool tp_initialize(TpPool* , int nthreads);
+// Run the queued tasks then stop the workers
+void tp_destroy(TpPool* );
+// Queue fn(arg), if wg is not NULL it is incremented now and decremented
+// when the task is done. Return false if the task could not be allocated
+// or queued, then wg is unchanged and fn is not called
+bool tp_submit(TpPool* , tp_task_f fn, void* arg, TpWaitGroup* wg);
+// Call fn on slices of [begin, end) of at most grain indices in parallel,
+// return when all are done. Slices that cannot be queued for lack of memory
+// are run by the calling thread
+void tp_parallel_for(TpPool* , size_t begin, size_t end, size_t grain,
+                     tp_range_f fn, void* arg);
+
+void tp_wg_initialize(TpWaitGroup* );
+void tp_wg_destroy(TpWaitGroup* );
+void tp_wg_add(TpWaitGroup* , long n);
+void tp_wg_done(TpWaitGroup* );
+// Run queued tasks until the count of wg drops to 0
+void tp_wait(TpPool* , TpWaitGroup* wg);
+
+#endif
+
+#ifdef TP_IMPLEMENTATION
+#include <unistd.h> /* for sysconf() */
+
+typedef struct {
+  tp_task_f fn;
+  void* arg;
+  TpWaitGroup* wg;
+} TpTask;
+
+typedef struct {
+  TpPool* pool;
+  tp_range_f fn;
+  void* arg;
+  size_t begin, end, grain;
+  TpWaitGroup* wg;
+} TpRange;
+
+// worker running the current thread, NULL outside of pools
+static _Thread_local TpWorker* tp_self = NULL;
+
+static WsdArray* wsd_new_array(int64_t size) {
+  WsdArray* a = malloc(sizeof(WsdArray) + size * sizeof(_Atomic(void*)));
+  if (a) {
+    a->size = size;
+    a->prev = NULL;
+  }
+  return a;
+}
+
+bool wsd_initialize(WsDeque* q) {
+  WsdArray* a = wsd_new_array(WSD_MIN_CAPACITY);
+  if (!a) {
+    return false;
+  }
+  atomic_init(&q->top, 0);
+  atomic_init(&q->bottom, 0);
+  atomic_init(&q->array, a);
+  return true;
+}
+
+void wsd_destroy(WsDeque* q) {
+  WsdArray* a = atomic_load(&q->array);
+  while (a) {
+    WsdArray* prev = a->prev;
+    TP_FREE(a);
+    a = prev;
+  }
+}
+
+bool wsd_push(WsDeque* q, void* data) {
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  WsdArray* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+
+  if (b - t > a->size - 1) {
+    // full, copy the live items in an array twice as big
+    WsdArray* bigger = wsd_new_array(2 * a->size);
+    if (!bigger) {
+      return false;
+    }
+    for (int64_t i = t; i < b; i++) {
+      atomic_store_explicit(
+        &bigger->items[i & (bigger->size - 1)],
+        atomic_load_explicit(&a->items[i & (a->size - 1)],
+                             memory_order_relaxed),
+        memory_order_relaxed);
+    }
+    bigger->prev = a;
+    atomic_store_explicit(&q->array, bigger, memory_order_release);
+    a = bigger;
+  }
+
+  atomic_store_explicit(&a->items[b & (a->size - 1)], data,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  return true;
+}
+
+void* wsd_pop(WsDeque* q) {
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  WsdArray* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  void* data = NULL;
+
+  // reserve the last item before looking at top
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+  if (t <= b) {
+    data = atomic_load_explicit(&a->items[b & (a->size - 1)],
+                                memory_order_relaxed);
+    if (t == b) {
+      // last item, race against thieves
+      if (!atomic_compare_exchange_strong_explicit(
+            &q->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        data = NULL;
+      }
+      atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    // empty
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return data;
+}
+
+void* wsd_steal(WsDeque* q) {
+  int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  if (t >= b) {
+    return NULL;
+  }
+  WsdArray* a = atomic_load_explicit(&q->array, memory_order_acquire);
+  void* data = atomic_load_explicit(&a->items[t & (a->size - 1)],
+                                    memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+        &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return data;
+}
+
+void tp_wg_initialize(TpWaitGroup* wg) {
+  atomic_init(&wg->count, 0);
+  pthread_mutex_init(&wg->mutex, NULL);
+  pthread_cond_init(&wg->cond, NULL);
+}
+
+void tp_wg_destroy(TpWaitGroup* wg) {
+  pthread_mutex_destroy(&wg->mutex);
+  pthread_cond_destroy(&wg->cond);
+}
+
+void tp_wg_add(TpWaitGroup* wg, long n) {
+  atomic_fetch_add(&wg->count, n);
+}
+
+void tp_wg_done(TpWaitGroup* wg) {
+  long count = atomic_load(&wg->count);
+  while (count > 1) {
+    if (atomic_compare_exchange_weak(&wg->count, &count, count - 1)) {
+      return;
+    }
+  }
+  // the last decrement holds the mutex, which tp_wait takes before
+  // returning, so that wg is not destroyed before this call is over
+  pthread_mutex_lock(&wg->mutex);
+  atomic_fetch_sub(&wg->count, 1);
+  pthread_cond_broadcast(&wg->cond);
+  pthread_mutex_unlock(&wg->mutex);
+}
+
+static uint32_t tp_random(uint32_t* x) {
+  // xorshift32
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+// Take a queued task: own deque, then submitted ones, then steal
+static TpTask* tp_find_task(TpPool* pool) {
+  TpWorker* self = tp_self && tp_self->pool == pool ? tp_self : NULL;
+  TpTask* task = NULL;
+  uint32_t seed = 2463534242u;
+  uint32_t* rng = self ? &self->rng : &seed;
+
+  if (!atomic_load(&pool->pending)) {
+    return NULL;
+  }
+
+  if (self && (task = wsd_pop(&self->deque))) {
+    return task;
+  }
+
+  pthread_mutex_lock(&pool->injected_mutex);
+  task = q_shift(&pool->injected);
+  pthread_mutex_unlock(&pool->injected_mutex);
+  if (task) {
+    return task;
+  }
+
+  int start = tp_random(rng) % pool->nworkers;
+  for (int i = 0; i < pool->nworkers; i++) {
+    TpWorker* victim = &pool->workers[(start + i) % pool->nworkers];
+    if (victim != self && (task = wsd_steal(&victim->deque))) {
+      return task;
+    }
+  }
+  return NULL;
+}
+
+static void tp_run(TpPool* pool, TpTask* task) {
+  atomic_fetch_sub(&pool->pending, 1);
+  task->fn(task->arg);
+  if (task->wg) {
+    tp_wg_done(task->wg);
+  }
+  TP_FREE(task);
+}
+
+static void* tp_worker_main(void* arg) {
+  TpWorker* self = arg;
+  TpPool* pool = self->pool;
+  tp_self = self;
+
+  for (;;) {
+    TpTask* task = tp_find_task(pool);
+    if (task) {
+      tp_run(pool, task);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    atomic_fetch_add(&pool->sleeping, 1);
+    while (!atomic_load(&pool->pending) && !atomic_load(&pool->stop)) {
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+    atomic_fetch_sub(&pool->sleeping, 1);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (atomic_load(&pool->stop) && !atomic_load(&pool->pending)) {
+      return NULL;
+    }
+  }
+}
+
+// Stop the first nstarted workers once the queued tasks are run
+static void tp_stop(TpPool* pool, int nstarted) {
+  pthread_mutex_lock(&pool->mutex);
+  atomic_store(&pool->stop, 1);
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (int i = 0; i < nstarted; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+}
+
+// Free the first ndeques deques and what tp_initialize set up before them
+static void tp_release(TpPool* pool, int ndeques) {
+  for (int i = 0; i < ndeques; i++) {
+    wsd_destroy(&pool->workers[i].deque);
+  }
+  TP_FREE(pool->workers);
+  q_destroy(&pool->injected);
+  pthread_mutex_destroy(&pool->injected_mutex);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+}
+
+bool tp_initialize(TpPool* pool, int nthreads) {
+  if (nthreads <= 0) {
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = nthreads > 0 ? nthreads : 1;
+  }
+  pool->nworkers = nthreads;
+  pool->workers = malloc(nthreads * sizeof(TpWorker));
+  if (!pool->workers) {
+    return false;
+  }
+
+  pool->injected = (Queue){0};
+  pthread_mutex_init(&pool->injected_mutex, NULL);
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->sleeping, 0);
+  atomic_init(&pool->stop, 0);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  for (int i = 0; i < nthreads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].rng = 2463534242u + 7919u * i;
+    if (!wsd_initialize(&pool->workers[i].deque)) {
+      tp_release(pool, i);
+      return false;
+    }
+  }
+  // deques are ready before any worker may steal
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool->workers[i].thread, NULL, tp_worker_main,
+                       &pool->workers[i])) {
+      // nothing is queued yet, the started workers return at once
+      tp_stop(pool, i);
+      tp_release(pool, nthreads);
+      return false;
+    }
+  }
+  return true;
+}
+
+void tp_destroy(TpPool* pool) {
+  tp_stop(pool, pool->nworkers);
+  tp_release(pool, pool->nworkers);
+}
+
+bool tp_submit(TpPool* pool, tp_task_f fn, void* arg, TpWaitGroup* wg) {
+  TpWorker* self = tp_self && tp_self->pool == pool ? tp_self : NULL;
+  TpTask* task;
+  TP_ALLOC(task, TpTask);
+  if (!task) {
+    return false;
+  }
+  task->fn = fn;
+  task->arg = arg;
+  task->wg = wg;
+  if (wg) {
+    tp_wg_add(wg, 1);
+  }
+
+  // counted before being visible so that it is never negative
+  atomic_fetch_add(&pool->pending, 1);
+  if (!self || !wsd_push(&self->deque, task)) {
+    pthread_mutex_lock(&pool->injected_mutex);
+    bool queued = q_unshift(&pool->injected, task);
+    pthread_mutex_unlock(&pool->injected_mutex);
+    if (!queued) {
+      atomic_fetch_sub(&pool->pending, 1);
+      if (wg) {
+        tp_wg_done(wg);
+      }
+      TP_FREE(task);
+      return false;
+    }
+  }
+
+  if (atomic_load(&pool->sleeping)) {
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  return true;
+}
+
+void tp_wait(TpPool* pool, TpWaitGroup* wg) {
+  while (atomic_load(&wg->count) > 0) {
+    TpTask* task = tp_find_task(pool);
+    if (task) {
+      tp_run(pool, task);
+    } else if (!atomic_load(&pool->pending)) {
+      // the remaining tasks of wg are running on other threads
+      pthread_mutex_lock(&wg->mutex);
+      while (atomic_load(&wg->count) > 0 && !atomic_load(&pool->pending)) {
+        pthread_cond_wait(&wg->cond, &wg->mutex);
+      }
+      pthread_mutex_unlock(&wg->mutex);
+    }
+  }
+  pthread_mutex_lock(&wg->mutex);
+  pthread_mutex_unlock(&wg->mutex);
+}
+
+static void tp_range_task(void* arg) {
+  TpRange* range = arg;
+
+  // hand the upper halves to thieves, keep the first slice, or all of the
+  // range when it cannot be split
+  while (range->end - range->begin > range->grain) {
+    TpRange* upper;
+    TP_ALLOC(upper, TpRange);
+    if (!upper) {
+      break;
+    }
+    size_t middle = range->begin + (range->end - range->begin) / 2;
+    *upper = *range;
+    upper->begin = middle;
+    if (!tp_submit(range->pool, tp_range_task, upper, range->wg)) {
+      TP_FREE(upper);
+      break;
+    }
+    range->end = middle;
+  }
+  range->fn(range->arg, range->begin, range->end);
+  TP_FREE(range);
+}
+
+void tp_parallel_for(TpPool* pool, size_t begin, size_t end, size_t grain,
+                     tp_range_f fn, void* arg) {
+  TpWaitGroup wg;
+  TpRange* range;
+
+  if (begin >= end) {
+    return;
+  }
+  TP_ALLOC(range, TpRange);
+  if (!range) {
+    fn(arg, begin, end);
+    return;
+  }
+  tp_wg_initialize(&wg);
+  *range = (TpRange){pool, fn, arg, begin, end, grain ? grain : 1, &wg};
+  tp_range_task(range);
+  tp_wait(pool, &wg);
+  tp_wg_destroy(&wg);
+}
+
+#endif // TP_IMPLEMENTATION
@@ -0,0 +1,147 @@
+/* Compare hash/adler_32.h with its original one-shot version on random
+ * buffers, whole with each implementation, fed by random pieces to the
+ * streaming functions and combined from two parts, and time them on a
+ * large buffer, then hashn on several threads.
+ * Usage: ./adler_32 [buffer size in MB]
+ * Exits with 1 if any digest differs from the original. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define ADLER_32_IMPLEMENTATION
+#include "../hash/adler_32.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+typedef uint32_t (*hash_fn)(const uint8_t*, size_t);
+
+typedef struct {
+  const char* name;
+  hash_fn fn;
+  int supported;
+} implementation;
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// hashn as first written
+uint32_t reference(const uint8_t* content, size_t length) {
+  uint16_t a = 1, b = 0;
+  for (size_t i = 0; i < length; i++) {
+    a = (a + content[i]) % 0xFFF1;
+    b = (b + a) % 0xFFF1;
+  }
+  return ((uint32_t)b << 16) | a;
+}
+
+// digest of a buffer cut in random pieces
+uint32_t adler32_pieces(const uint8_t* content, size_t length) {
+  adler32_state state;
+  adler32_init(&state);
+  while (length) {
+    size_t n = next() % 40;
+    n = n < length ? n : length;
+    adler32_update(&state, content, n);
+    content += n;
+    length -= n;
+  }
+  return adler32_final(&state);
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 16) << 20;
+  implementation impls[] = {
+    {"original", reference, 1},
+    {"portable", adler32_portable, 1},
+#ifdef ADLER_32_X86
+    {"ssse3", adler32_ssse3, __builtin_cpu_supports("ssse3")},
+    {"avx2", adler32_avx2, __builtin_cpu_supports("avx2")},
+#endif
+    {"hashn", hashn, 1},
+  };
+  int nimpls = sizeof(impls) / sizeof(impls[0]);
+  // around the blocks between two modulo
+  size_t lengths[] = { 1000, 5551, 5552, 5553, 11104, 11105, 100000 };
+  uint8_t* buf = malloc(size + 64);
+  long errors = 0;
+
+  seed(42);
+  for (size_t i = 0; i < size + 64; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  errors += hash("Wikipedia") != reference((const uint8_t*)"Wikipedia", 9);
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length < 300 + sizeof(lengths) / sizeof(size_t);
+         length++) {
+      size_t n = length < 300 ? length : lengths[length - 300];
+      uint32_t expected = reference(buf + offset, n);
+      for (int i = 1; i < nimpls; i++) {
+        if (impls[i].supported && impls[i].fn(buf + offset, n) != expected) {
+          printf("%s differs on %zu bytes at offset %zu\n", impls[i].name,
+                 n, offset);
+          errors++;
+        }
+      }
+      errors += adler32_pieces(buf + offset, n) != expected;
+      size_t cut = n ? next() % (n + 1) : 0;
+      errors += adler32_combine(reference(buf + offset, cut),
+                                reference(buf + offset + cut, n - cut),
+                                n - cut) != expected;
+    }
+  }
+
+  // largest sums between two modulo
+  memset(buf, 0xFF, 100000);
+  for (int i = 1; i < nimpls; i++) {
+    errors += impls[i].supported
+      && impls[i].fn(buf, 100000) != reference(buf, 100000);
+  }
+  seed(43);
+  for (size_t i = 0; i < 100000; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  printf("%zuMB buffer\n", size >> 20);
+  uint32_t expected = reference(buf + 1, size);
+  double start, elapsed;
+  for (int i = 0; i < nimpls; i++) {
+    if (!impls[i].supported) {
+      printf("%-10s not supported\n", impls[i].name);
+      continue;
+    }
+    start = now();
+    errors += impls[i].fn(buf + 1, size) != expected;
+    elapsed = now() - start;
+    printf("%-10s %.3fs, %7.1f MB/s\n", impls[i].name, elapsed,
+           size / elapsed * 1e-6);
+  }
+
+  // no thread for a count below 2
+  for (int nthreads = -1; nthreads <= 1; nthreads++) {
+    errors += hashn_parallel(buf + 1, size, nthreads) != expected;
+  }
+
+  // threads hash parts of the buffer, fewer for smaller buffers
+  for (int nthreads = 2; nthreads <= 8; nthreads *= 2) {
+    start = now();
+    uint32_t parallel = hashn_parallel(buf + 1, size, nthreads);
+    elapsed = now() - start;
+    errors += parallel != expected;
+    errors += hashn_parallel(buf + 1, 1000000, nthreads)
+      != hashn(buf + 1, 1000000);
+    printf("%d threads  %.3fs, %7.1f MB/s\n", nthreads, elapsed,
+           size / elapsed * 1e-6);
+  }
+
+  free(buf);
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+/* Compare hash/adler_32x.h with its original one-shot version on random
+ * buffers, whole and fed by random pieces to the streaming functions, and
+ * time both on a large buffer.
+ * Usage: ./adler_32x [buffer size in MB]
+ * Exits with 1 if any digest differs from the original. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define ADLER_32X_IMPLEMENTATION
+#include "../hash/adler_32x.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// hashn as first written
+uint32_t reference(const uint8_t* content, size_t length) {
+  uint16_t a = 1 << 9, b = 0;
+  for (size_t i = 0; i < length; i++) {
+    a = ((a << 7) + (a >> 9) + content[i]) % 0xFFF1;
+    b = (b + a) % 0xFFF1;
+  }
+  return ((uint32_t)b << 16) | a;
+}
+
+// digest of a buffer cut in random pieces
+uint32_t adler32x_pieces(const uint8_t* content, size_t length) {
+  adler32x_state state;
+  adler32x_init(&state);
+  while (length) {
+    size_t n = next() % 40;
+    n = n < length ? n : length;
+    adler32x_update(&state, content, n);
+    content += n;
+    length -= n;
+  }
+  return adler32x_final(&state);
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 16) << 20;
+  size_t lengths[] = { 1000, 5551, 5552, 5553, 100000 };
+  uint8_t* buf = malloc(size + 64);
+  long errors = 0;
+
+  seed(42);
+  for (size_t i = 0; i < size + 64; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  errors += hash("Wikipedia") != reference((const uint8_t*)"Wikipedia", 9);
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length < 300 + sizeof(lengths) / sizeof(size_t);
+         length++) {
+      size_t n = length < 300 ? length : lengths[length - 300];
+      uint32_t expected = reference(buf + offset, n);
+      errors += hashn(buf + offset, n) != expected;
+      errors += adler32x_pieces(buf + offset, n) != expected;
+    }
+  }
+
+  printf("%zuMB buffer\n", size >> 20);
+  double start = now();
+  uint32_t expected = reference(buf + 1, size);
+  double elapsed = now() - start;
+  printf("%-10s %.3fs, %7.1f MB/s\n", "original", elapsed,
+         size / elapsed * 1e-6);
+  start = now();
+  errors += hashn(buf + 1, size) != expected;
+  elapsed = now() - start;
+  printf("%-10s %.3fs, %7.1f MB/s\n", "hashn", elapsed,
+         size / elapsed * 1e-6);
+
+  free(buf);
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/* Comparison of structures/avlt.h instantiated for uint64_t keys with
+ * structures/avl.h on boxed keys, a string instantiation, and overlap
+ * queries on an interval instantiation against a linear scan.
+ * Usage: ./avlt [number of keys]
+ * Exits with 1 if both trees do not agree or if the tree is unbalanced. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define AVL_IMPLEMENTATION
+#include "../structures/avl.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+#define AVLT_TYPE U64Tree
+#define AVLT_PREFIX u64t
+#define AVLT_KEY uint64_t
+#define AVLT_IMPLEMENTATION
+#include "../structures/avlt.h"
+
+#define AVLT_TYPE StrTree
+#define AVLT_PREFIX strt
+#define AVLT_KEY const char*
+#define AVLT_CMP(a, b) strcmp(a, b)
+#define AVLT_IMPLEMENTATION
+#include "../structures/avlt.h"
+
+#define AVLT_TYPE IntervalTree
+#define AVLT_PREFIX it
+#define AVLT_KEY uint64_t
+#define AVLT_INTERVAL
+#define AVLT_IMPLEMENTATION
+#include "../structures/avlt.h"
+
+#define SPAN 1000000000
+#define LENGTH 10000
+#define QUERIES 2000
+
+int u64cmp(const void* key1, const void* key2) {
+  uint64_t val1 = *(const uint64_t *)key1;
+  uint64_t val2 = *(const uint64_t *)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+uint64_t* box(uint64_t v) {
+  uint64_t* b = malloc(sizeof(uint64_t));
+  *b = v;
+  return b;
+}
+
+/* check the maximum ends of a subtree, return it or 0 */
+uint64_t check_ends(IntervalTreeNode* node, int* errors) {
+  uint64_t l, r, max;
+  if (!node) {
+    return 0;
+  }
+  l = check_ends(node->left, errors);
+  r = check_ends(node->right, errors);
+  max = node->end;
+  max = l > max ? l : max;
+  max = r > max ? r : max;
+  *errors += node->max_end != max;
+  return max;
+}
+
+double since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* check ordering and balance of a subtree, return its depth or -1 */
+int check(U64TreeNode* node, uint64_t* last, size_t* count) {
+  int l, r;
+  if (!node) {
+    return 0;
+  }
+  l = check(node->left, last, count);
+  if (l < 0 || (*count && node->key <= *last)) {
+    return -1;
+  }
+  *last = node->key;
+  (*count)++;
+  r = check(node->right, last, count);
+  if (r < 0 || l - r > 1 || r - l > 1 || node->depth != (l > r ? l : r) + 1) {
+    return -1;
+  }
+  return node->depth;
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  uint64_t* keys = malloc(n * sizeof(uint64_t));
+  const char* words[] = {"one", "two", "three", "four", "five"};
+  uint64_t* ends;
+  IntervalTree it;
+  long found, expected;
+  size_t j;
+  uint64_t last;
+  AvlTree avl;
+  U64Tree t;
+  StrTree s;
+  clock_t start;
+  size_t i, count;
+  int errors = 0;
+
+  seed(42);
+  for (i = 0; i < n; i++) {
+    /* odd values so that even values are never present */
+    keys[i] = next() | 1;
+  }
+
+  avl_initialize(&avl, u64cmp, free);
+  u64t_initialize(&t);
+
+  printf("%zu keys\n", n);
+  printf("%-12s %10s %10s\n", "", "avl", "avlt");
+
+  printf("%-12s", "insert");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    avl_insert(&avl, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    u64t_insert(&t, keys[i], (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs\n", since(start));
+
+  printf("%-12s", "search");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    errors += avl_search(&avl, &keys[i]) != (void *)(uintptr_t)(i + 1);
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    errors += u64t_search(&t, keys[i]) != (void *)(uintptr_t)(i + 1);
+  }
+  printf(" %9.3fs\n", since(start));
+  for (i = 0; i < n; i++) {
+    errors += u64t_search(&t, keys[i] + 1) != NULL;
+  }
+
+  printf("%-12s", "remove half");
+  start = clock();
+  for (i = 0; i < n; i += 2) {
+    errors += avl_remove(&avl, &keys[i]) != (void *)(uintptr_t)(i + 1);
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i += 2) {
+    errors += u64t_remove(&t, keys[i]) != (void *)(uintptr_t)(i + 1);
+  }
+  printf(" %9.3fs\n", since(start));
+
+  count = 0;
+  if (check(t.root, &last, &count) < 0 || count != n / 2) {
+    printf("avlt tree is invalid\n");
+    errors++;
+  }
+  printf("%-12s %10s %10d\n", "depth", "-", u64t_tree_depth(&t));
+
+  for (i = 0; i < n; i++) {
+    void* expected = (i % 2) ? (void *)(uintptr_t)(i + 1) : NULL;
+    errors += avl_search(&avl, &keys[i]) != expected;
+    errors += u64t_search(&t, keys[i]) != expected;
+  }
+
+  avl_destroy(&avl, NULL);
+  u64t_destroy(&t, NULL);
+  free(keys);
+
+  /* keys compared by content, not by address */
+  strt_initialize(&s);
+  for (i = 0; i < 5; i++) {
+    strt_insert(&s, words[i], (void *)(uintptr_t)(i + 1));
+  }
+  errors += strt_search(&s, "three") != (void *)3;
+  errors += strt_insert(&s, "two", (void *)20) != (void *)2;
+  errors += strt_remove(&s, "one") != (void *)1;
+  errors += strt_search(&s, "one") != NULL;
+  errors += strt_search(&s, "two") != (void *)20;
+  strt_destroy(&s, NULL);
+
+  /* intervals of length up to LENGTH, starting in [0, SPAN) */
+  keys = malloc(n * sizeof(uint64_t));
+  ends = malloc(n * sizeof(uint64_t));
+  it_initialize(&it);
+  for (i = 0; i < n; i++) {
+    keys[i] = next() % SPAN;
+    ends[i] = keys[i] + next() % LENGTH;
+    /* a start drawn twice keeps the last end, the others are forgotten
+     * below by moving them out of reach */
+    it_insert(&it, keys[i], ends[i], (void *)(uintptr_t)(i + 1));
+  }
+  for (i = 0; i < n; i++) {
+    if (it_search(&it, keys[i]) != (void *)(uintptr_t)(i + 1)) {
+      keys[i] = UINT64_MAX;
+    }
+  }
+  for (i = 0; i < n; i += 3) {
+    it_remove(&it, keys[i]);
+    keys[i] = UINT64_MAX;
+  }
+  check_ends(it.root, &errors);
+
+  printf("%-12s %10s %10s\n", "", "scan", "overlaps");
+  printf("%-12s", "overlaps");
+  found = expected = 0;
+  start = clock();
+  for (j = 0; j < QUERIES; j++) {
+    uint64_t lo = (j * 7919) % SPAN, hi = lo + LENGTH;
+    for (i = 0; i < n; i++) {
+      expected += keys[i] <= hi && ends[i] >= lo;
+    }
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (j = 0; j < QUERIES; j++) {
+    uint64_t lo = (j * 7919) % SPAN, hi = lo + LENGTH;
+    found += it_overlaps(&it, lo, hi, NULL);
+  }
+  printf(" %9.3fs\n", since(start));
+  errors += found != expected;
+
+  it_destroy(&it, NULL);
+  free(keys);
+  free(ends);
+
+  if (errors) {
+    printf("%d errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
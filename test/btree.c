@@ -0,0 +1,174 @@
+/* Head to head comparison of structures/btree.h and structures/avl.h.
+ * Usage: ./btree [number of keys]
+ * Exits with 1 if both trees do not agree. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define AVL_IMPLEMENTATION
+#include "../structures/avl.h"
+#define BTREE_IMPLEMENTATION
+#include "../structures/btree.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+static uint64_t visited;
+
+int u64cmp(const void* key1, const void* key2) {
+  uint64_t val1 = *(const uint64_t *)key1;
+  uint64_t val2 = *(const uint64_t *)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+uint64_t* box(uint64_t v) {
+  uint64_t* b = malloc(sizeof(uint64_t));
+  *b = v;
+  return b;
+}
+
+void count_visit(const void* key, void* data) {
+  (void)key;
+  visited += (uintptr_t)data;
+}
+
+double since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  uint64_t* keys = malloc(n * sizeof(uint64_t));
+  uint64_t lo = UINT64_MAX / 4, hi = UINT64_MAX / 2, expected;
+  AvlTree avl;
+  BTree bt, bti;
+  clock_t start;
+  size_t i;
+  int errors = 0;
+
+  seed(42);
+  for (i = 0; i < n; i++) {
+    /* odd values so that even values are never present */
+    keys[i] = next() | 1;
+  }
+
+  avl_initialize(&avl, u64cmp, free);
+  bt_initialize(&bt, u64cmp, free);
+  bt_initialize(&bti, NULL, NULL);
+
+  printf("%zu keys, btree node of %d keys (%zu bytes per leaf)\n",
+         n, (int)BTREE_MAX_KEYS, sizeof(BTreeNode));
+  printf("%-12s %10s %10s %10s\n", "", "avl", "btree", "btree int");
+
+  printf("%-12s", "insert");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    avl_insert(&avl, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    bt_insert(&bt, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    bt_insert(&bti, BTREE_INT_KEY(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs\n", since(start));
+
+  printf("%-12s", "search");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    if (avl_search(&avl, &keys[i]) != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    if (bt_search(&bt, &keys[i]) != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    if (bt_search(&bti, BTREE_INT_KEY(keys[i]))
+        != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+    if (bt_search(&bti, BTREE_INT_KEY(keys[i] + 1))) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs\n", since(start));
+
+  expected = 0;
+  for (i = 0; i < n; i++) {
+    if (keys[i] >= lo && keys[i] <= hi) {
+      expected += i + 1;
+    }
+  }
+  printf("%-12s %10s", "range", "-");
+  visited = 0;
+  start = clock();
+  bt_range(&bt, &lo, &hi, count_visit);
+  printf(" %9.3fs", since(start));
+  errors += visited != expected;
+  visited = 0;
+  start = clock();
+  bt_range(&bti, BTREE_INT_KEY(lo), BTREE_INT_KEY(hi), count_visit);
+  printf(" %9.3fs\n", since(start));
+  errors += visited != expected;
+
+  printf("%-12s %10d %10d %10d\n", "depth", avl_tree_depth(&avl),
+         bt_tree_depth(&bt), bt_tree_depth(&bti));
+
+  printf("%-12s", "remove half");
+  start = clock();
+  for (i = 0; i < n; i += 2) {
+    if (avl_remove(&avl, &keys[i]) != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i += 2) {
+    if (bt_remove(&bt, &keys[i]) != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i += 2) {
+    if (bt_remove(&bti, BTREE_INT_KEY(keys[i]))
+        != (void *)(uintptr_t)(i + 1)) {
+      errors++;
+    }
+  }
+  printf(" %9.3fs\n", since(start));
+
+  for (i = 0; i < n; i++) {
+    void* expected_data = (i % 2) ? (void *)(uintptr_t)(i + 1) : NULL;
+    errors += avl_search(&avl, &keys[i]) != expected_data;
+    errors += bt_search(&bt, &keys[i]) != expected_data;
+    errors += bt_search(&bti, BTREE_INT_KEY(keys[i])) != expected_data;
+  }
+
+  for (i = 1; i < n; i += 2) {
+    void* expected_data = (void *)(uintptr_t)(i + 1);
+    errors += bt_remove(&bti, BTREE_INT_KEY(keys[i])) != expected_data;
+  }
+  errors += bt_tree_depth(&bti) != 0;
+
+  avl_destroy(&avl, NULL);
+  bt_destroy(&bt, NULL);
+  bt_destroy(&bti, NULL);
+  free(keys);
+
+  if (errors) {
+    printf("%d errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
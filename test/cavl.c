@@ -0,0 +1,299 @@
+/* Mixed workload on structures/cavl.h against structures/avl.h behind a
+ * mutex, for increasing numbers of threads. Each thread inserts and removes
+ * its own keys (k % threads == id) and searches any key, so it knows what
+ * the searches of its own keys must return. The tree is checked for order
+ * and balance after each run. A last run removes random keys and inserts
+ * increasing ones, and checks that the routing nodes left by the removals
+ * do not pile up.
+ * Usage: ./cavl [number of keys] [operations per thread] [max threads]
+ * Exits with 1 on inconsistencies. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define AVL_IMPLEMENTATION
+#include "../structures/avl.h"
+#define CAVL_IMPLEMENTATION
+#include "../structures/cavl.h"
+
+/* percentage of operations that insert, the same amount removes */
+#define WRITES 10
+
+typedef struct {
+  CavlTree* cavl;
+  AvlTree* avl;
+  pthread_mutex_t* mutex;
+  int id, nthreads, nkeys;
+  long ops;
+  long errors;
+} worker_arg;
+
+int intcmp(const void* key1, const void* key2) {
+  int val1 = *(const int *)key1;
+  int val2 = *(const int *)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+int* box(int v) {
+  int* b = malloc(sizeof(int));
+  *b = v;
+  return b;
+}
+
+/* per thread splitmix64 */
+uint64_t step(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* initial content: every even key, with data key + 1 */
+int present(int k) {
+  return k % 2 == 0;
+}
+
+void* worker(void* p) {
+  worker_arg* arg = p;
+  uint64_t state = 0x1234567 + arg->id;
+  char* own = malloc(arg->nkeys);
+  void* data;
+  long i;
+  int k, r;
+
+  for (k = 0; k < arg->nkeys; k++) {
+    own[k] = present(k);
+  }
+
+  for (i = 0; i < arg->ops; i++) {
+    uint64_t x = step(&state);
+    r = (int)(x % 100);
+    k = (int)((x >> 32) % arg->nkeys);
+    if (r < 2 * WRITES) {
+      /* move to a key of this thread */
+      k = k - k % arg->nthreads + arg->id;
+      if (k >= arg->nkeys) {
+        continue;
+      }
+    }
+
+    if (r < WRITES) {
+      if (arg->cavl) {
+        data = cavl_insert(arg->cavl, box(k), (void *)(intptr_t)(k + 1));
+      } else {
+        pthread_mutex_lock(arg->mutex);
+        data = avl_insert(arg->avl, box(k), (void *)(intptr_t)(k + 1));
+        pthread_mutex_unlock(arg->mutex);
+      }
+      arg->errors += data != (own[k] ? (void *)(intptr_t)(k + 1) : NULL);
+      own[k] = 1;
+    } else if (r < 2 * WRITES) {
+      if (arg->cavl) {
+        data = cavl_remove(arg->cavl, &k);
+      } else {
+        pthread_mutex_lock(arg->mutex);
+        data = avl_remove(arg->avl, &k);
+        pthread_mutex_unlock(arg->mutex);
+      }
+      arg->errors += data != (own[k] ? (void *)(intptr_t)(k + 1) : NULL);
+      own[k] = 0;
+    } else {
+      if (arg->cavl) {
+        data = cavl_search(arg->cavl, &k);
+      } else {
+        pthread_mutex_lock(arg->mutex);
+        data = avl_search(arg->avl, &k);
+        pthread_mutex_unlock(arg->mutex);
+      }
+      if (data && data != (void *)(intptr_t)(k + 1)) {
+        arg->errors++;
+      } else if (k % arg->nthreads == arg->id) {
+        arg->errors += (data != NULL) != own[k];
+      }
+    }
+  }
+  free(own);
+  return NULL;
+}
+
+/* each thread keeps CHURN_KEYS of its keys, removes a random one and
+ * inserts a new larger one */
+#define CHURN_KEYS 2500
+
+void* churn(void* p) {
+  worker_arg* arg = p;
+  uint64_t state = 0x7654321 + arg->id;
+  int* live = malloc(CHURN_KEYS * sizeof(int));
+  int next = arg->id;
+  long i;
+  int j;
+
+  for (j = 0; j < CHURN_KEYS; j++) {
+    live[j] = next;
+    arg->errors += cavl_insert(arg->cavl, box(next), (void *)1) != NULL;
+    next += arg->nthreads;
+  }
+  for (i = 0; i < arg->ops; i++) {
+    j = (int)(step(&state) % CHURN_KEYS);
+    arg->errors += cavl_remove(arg->cavl, &live[j]) != (void *)1;
+    live[j] = next;
+    arg->errors += cavl_insert(arg->cavl, box(next), (void *)1) != NULL;
+    next += arg->nthreads;
+  }
+  free(live);
+  return NULL;
+}
+
+/* count the routing nodes with less than two children, which must have
+ * been unlinked */
+long stale(CavlNode* node) {
+  CavlNode* l,* r;
+  if (!node) {
+    return 0;
+  }
+  l = atomic_load(&node->child[CAVL_LEFT]);
+  r = atomic_load(&node->child[CAVL_RIGHT]);
+  return (atomic_load(&node->deleted) && !(l && r)) + stale(l) + stale(r);
+}
+
+/* check ordering and balance of a subtree, return its depth or -1 */
+int check(CavlNode* node, int* last, int* count) {
+  int l, r, k, depth;
+  if (!node) {
+    return 0;
+  }
+  l = check(atomic_load(&node->child[CAVL_LEFT]), last, count);
+  k = *(int *)node->key;
+  if (l < 0 || (*count && k <= *last)) {
+    return -1;
+  }
+  *last = k;
+  (*count)++;
+  r = check(atomic_load(&node->child[CAVL_RIGHT]), last, count);
+  depth = atomic_load(&node->depth);
+  if (r < 0 || l - r > 1 || r - l > 1 || depth != (l > r ? l : r) + 1) {
+    return -1;
+  }
+  return depth;
+}
+
+/* run the workload on one tree, return the number of errors */
+long run(CavlTree* cavl, AvlTree* avl, int nthreads, int nkeys, long ops,
+         double* elapsed) {
+  pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
+  worker_arg* args = malloc(nthreads * sizeof(worker_arg));
+  pthread_mutex_t mutex;
+  long errors = 0;
+  double start;
+  int i;
+
+  pthread_mutex_init(&mutex, NULL);
+  start = now();
+  for (i = 0; i < nthreads; i++) {
+    args[i].cavl = cavl;
+    args[i].avl = avl;
+    args[i].mutex = &mutex;
+    args[i].id = i;
+    args[i].nthreads = nthreads;
+    args[i].nkeys = nkeys;
+    args[i].ops = ops;
+    args[i].errors = 0;
+    pthread_create(&threads[i], NULL, worker, &args[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    errors += args[i].errors;
+  }
+  *elapsed = now() - start;
+
+  pthread_mutex_destroy(&mutex);
+  free(threads);
+  free(args);
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  int nkeys = argc > 1 ? atoi(argv[1]) : 100000;
+  long ops = argc > 2 ? atol(argv[2]) : 200000;
+  int maxthreads = argc > 3 ? atoi(argv[3]) : 8;
+  long errors = 0;
+  double tc, ta;
+  int nthreads, k, last, count;
+  CavlTree cavl;
+  AvlTree avl;
+
+  printf("%d keys, %ld operations per thread, %d%% inserts, %d%% removes\n",
+         nkeys, ops, WRITES, WRITES);
+  printf("%-8s %14s %14s\n", "threads", "cavl ops/s", "avl+mutex ops/s");
+
+  for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+    cavl_initialize(&cavl, intcmp, free);
+    avl_initialize(&avl, intcmp, free);
+    for (k = 0; k < nkeys; k++) {
+      if (present(k)) {
+        cavl_insert(&cavl, box(k), (void *)(intptr_t)(k + 1));
+        avl_insert(&avl, box(k), (void *)(intptr_t)(k + 1));
+      }
+    }
+
+    errors += run(&cavl, NULL, nthreads, nkeys, ops, &tc);
+    errors += run(NULL, &avl, nthreads, nkeys, ops, &ta);
+
+    count = 0;
+    if (check(atomic_load(&cavl.holder.child[CAVL_RIGHT]), &last, &count)
+        < 0) {
+      printf("cavl tree is invalid\n");
+      errors++;
+    }
+    cavl_reclaim(&cavl);
+
+    printf("%-8d %14.0f %14.0f\n", nthreads,
+           nthreads * ops / tc, nthreads * ops / ta);
+
+    cavl_destroy(&cavl, NULL);
+    avl_destroy(&avl, NULL);
+  }
+
+  /* routing nodes only have two children, so there are less of them than
+   * live keys */
+  nthreads = maxthreads;
+  pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
+  worker_arg* args = malloc(nthreads * sizeof(worker_arg));
+  cavl_initialize(&cavl, intcmp, free);
+  for (k = 0; k < nthreads; k++) {
+    args[k].cavl = &cavl;
+    args[k].id = k;
+    args[k].nthreads = nthreads;
+    args[k].ops = 4 * ops;
+    args[k].errors = 0;
+    pthread_create(&threads[k], NULL, churn, &args[k]);
+  }
+  for (k = 0; k < nthreads; k++) {
+    pthread_join(threads[k], NULL);
+    errors += args[k].errors;
+  }
+  count = 0;
+  if (check(atomic_load(&cavl.holder.child[CAVL_RIGHT]), &last, &count) < 0
+      || stale(atomic_load(&cavl.holder.child[CAVL_RIGHT]))
+      || count >= 2 * nthreads * CHURN_KEYS) {
+    printf("routing nodes were not unlinked\n");
+    errors++;
+  }
+  printf("churn: %d nodes for %d keys\n", count, nthreads * CHURN_KEYS);
+  cavl_destroy(&cavl, NULL);
+  free(threads);
+  free(args);
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
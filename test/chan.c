@@ -0,0 +1,317 @@
+/* A producer thread sends a sequence of integers through structures/chan.h
+ * to a consumer thread, which checks that they arrive in order, one at a
+ * time, by batches and with zero-copy reservations, as variable-size
+ * messages of a byte channel, with blocking calls, the producer pausing
+ * between bursts, and from a child process through shared memory.
+ * Usage: ./chan [number of messages] [capacity]
+ * Exits with 1 if a message is lost, duplicated or out of order. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define CHAN_IMPL
+#include "../structures/chan.h"
+
+#define BATCH 64
+
+enum { SINGLE, BATCHED, ZERO_COPY, BYTES, BLOCKING };
+
+// messages between two pauses of the producer in blocking mode
+#define BURST 100000
+
+// length of the message of sequence number i
+#define MSG_LEN(i) ((size_t)(i) * 7 % 200)
+
+typedef struct {
+  chan_state* chan;
+  bchan_state* bchan;
+  int mode;
+  long count, errors;
+  double cpu;
+} worker_arg;
+
+double cpu_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void* producer(void* p) {
+  worker_arg* arg = p;
+  void* batch[BATCH];
+  void** nodes;
+  size_t n, k;
+  long i = 1;
+  while (i <= arg->count) {
+    n = arg->count - i + 1 < BATCH ? arg->count - i + 1 : BATCH;
+    if (arg->mode == SINGLE) {
+      k = chan_push(arg->chan, (void*)(uintptr_t)i);
+    } else if (arg->mode == BLOCKING) {
+      if (i % BURST == 0) {
+        nanosleep(&(struct timespec){0, 1000000}, NULL);
+      }
+      k = chan_push_wait(arg->chan, (void*)(uintptr_t)i, -1);
+    } else if (arg->mode == BATCHED) {
+      for (size_t j = 0; j < n; j++) {
+        batch[j] = (void*)(uintptr_t)(i + j);
+      }
+      k = chan_push_n(arg->chan, batch, n);
+    } else if (arg->mode == BYTES) {
+      unsigned char* msg = bchan_reserve(arg->bchan, MSG_LEN(i));
+      for (size_t j = 0; msg && j < MSG_LEN(i); j++) {
+        msg[j] = (unsigned char)(i + j);
+      }
+      if ((k = msg != NULL)) {
+        bchan_commit(arg->bchan, MSG_LEN(i));
+      }
+    } else {
+      k = chan_reserve(arg->chan, &nodes, n);
+      for (size_t j = 0; j < k; j++) {
+        nodes[j] = (void*)(uintptr_t)(i + j);
+      }
+      chan_commit(arg->chan, k);
+    }
+    if (!k) {
+      // let the consumer run on a single core
+      sched_yield();
+    }
+    i += k;
+  }
+  return NULL;
+}
+
+void* consumer(void* p) {
+  worker_arg* arg = p;
+  double start = cpu_time();
+  void* batch[BATCH];
+  void** nodes;
+  size_t k;
+  long i = 1;
+  while (i <= arg->count) {
+    if (arg->mode == SINGLE) {
+      k = chan_pop(arg->chan, batch);
+      nodes = batch;
+    } else if (arg->mode == BLOCKING) {
+      k = chan_pop_wait(arg->chan, batch, -1);
+      nodes = batch;
+    } else if (arg->mode == BATCHED) {
+      k = chan_pop_n(arg->chan, batch, BATCH);
+      nodes = batch;
+    } else if (arg->mode == BYTES) {
+      size_t len;
+      const unsigned char* msg = bchan_peek(arg->bchan, &len);
+      if ((k = msg != NULL)) {
+        arg->errors += len != MSG_LEN(i);
+        for (size_t j = 0; j < len; j++) {
+          arg->errors += msg[j] != (unsigned char)(i + j);
+        }
+        bchan_release(arg->bchan);
+      }
+      i += k;
+      if (!k) {
+        sched_yield();
+      }
+      continue;
+    } else {
+      k = chan_peek(arg->chan, &nodes, BATCH);
+    }
+    for (size_t j = 0; j < k; j++) {
+      arg->errors += (uintptr_t)nodes[j] != (uintptr_t)(i + j);
+    }
+    if (arg->mode == ZERO_COPY) {
+      chan_release(arg->chan, k);
+    }
+    if (!k) {
+      sched_yield();
+    }
+    i += k;
+  }
+  arg->cpu = cpu_time() - start;
+  return NULL;
+}
+
+// child process sending count messages through shared memory
+int send_shm(const char* name, long count) {
+  bchan_state* b = bchan_shm_attach(name);
+  if (!b) {
+    return 1;
+  }
+  for (long i = 0; i < count; i++) {
+    unsigned char* msg = bchan_reserve_wait(b, MSG_LEN(i), -1);
+    for (size_t j = 0; j < MSG_LEN(i); j++) {
+      msg[j] = (unsigned char)(i + j);
+    }
+    bchan_commit(b, MSG_LEN(i));
+  }
+  bchan_free(b);
+  return 0;
+}
+
+// receive the messages of send_shm, return the number of errors
+long recv_shm(long count, size_t capacity) {
+  char name[64];
+  long errors = 0;
+  size_t len;
+  snprintf(name, sizeof(name), "/chan-test-%d", (int)getpid());
+  bchan_state* b = bchan_shm_create(name, capacity);
+  if (!b) {
+    return 1;
+  }
+
+  double start = now();
+  pid_t pid = fork();
+  if (!pid) {
+    _exit(send_shm(name, count));
+  }
+  for (long i = 0; i < count; i++) {
+    const unsigned char* msg = bchan_peek_wait(b, &len, 10000000000);
+    if (!msg) {
+      errors++;
+      break;
+    }
+    errors += len != MSG_LEN(i);
+    for (size_t j = 0; j < len; j++) {
+      errors += msg[j] != (unsigned char)(i + j);
+    }
+    bchan_release(b);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  errors += !WIFEXITED(status) || WEXITSTATUS(status);
+  double elapsed = now() - start;
+  printf("%-10s %.3fs, %.1fM msgs/s\n", "process", elapsed,
+         count / elapsed * 1e-6);
+
+  bchan_free(b);
+  shm_unlink(name);
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  long count = argc > 1 ? strtol(argv[1], NULL, 10) : 10000000;
+  size_t capacity = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+  long errors = 0;
+  void* data;
+
+  // capacity is rounded to 8, wrap around several times
+  chan_state* s = chan_new_state(5);
+  for (int round = 0; round < 3; round++) {
+    for (uintptr_t i = 0; i < 8; i++) {
+      errors += !chan_push(s, (void*)(i + 1));
+    }
+    errors += chan_push(s, (void*)9);
+    for (uintptr_t i = 0; i < 8; i++) {
+      errors += !chan_pop(s, &data) || data != (void*)(i + 1);
+    }
+    errors += chan_pop(s, &data) || data != NULL;
+  }
+  // reservations stop at the end of the ring
+  void* batch[8] = {0};
+  void** nodes;
+  errors += chan_push_n(s, batch, 5) != 5 || chan_pop_n(s, batch, 8) != 5;
+  errors += chan_reserve(s, &nodes, 8) != 3;
+  chan_commit(s, 3);
+  errors += chan_reserve(s, &nodes, 8) != 5;
+  errors += chan_push_n(s, batch, 8) != 5;
+  errors += chan_peek(s, &nodes, 8) != 3;
+  chan_release(s, 3);
+  errors += chan_pop_n(s, batch, 8) != 5;
+  chan_free(s);
+
+  // a message always fits twice its size
+  bchan_state* b = bchan_new_state(0);
+  size_t len;
+  errors += bchan_reserve(b, 17) == NULL;
+  bchan_commit(b, 5);
+  errors += !bchan_send(b, "0123456789", 10);
+  errors += bchan_peek(b, &len) == NULL || len != 5;
+  bchan_release(b);
+  errors += memcmp(bchan_peek(b, &len), "0123456789", 10) || len != 10;
+  bchan_release(b);
+  errors += bchan_peek(b, &len) != NULL;
+  for (int round = 0; round < 10; round++) {
+    errors += !bchan_send(b, "0123456789abcdef", 16);
+    errors += bchan_peek(b, &len) == NULL || len != 16;
+    bchan_release(b);
+  }
+  errors += bchan_reserve(b, 100) != NULL;
+  bchan_free(b);
+
+  // blocking calls time out
+  s = chan_new_state(1);
+  double start = now();
+  errors += chan_pop_wait(s, &data, 10000000);
+  errors += now() - start < 0.01;
+  errors += !chan_push_wait(s, (void*)1, 0) || chan_push_wait(s, (void*)2, 0);
+  errors += !chan_pop_wait(s, &data, -1) || data != (void*)1;
+  chan_free(s);
+
+  const char* names[] = {
+    "single", "batched", "zero-copy", "bytes", "blocking"
+  };
+  printf("%ld messages, capacity %zu\n", count, capacity);
+  for (int mode = SINGLE; mode <= BLOCKING; mode++) {
+    s = chan_new_state(capacity);
+    chan_state* s2 = chan_share_state(s);
+    // same memory as the pointers, enough for the largest message
+    b = bchan_new_state(capacity * sizeof(void*) < 512
+                        ? 512 : capacity * sizeof(void*));
+    bchan_state* b2 = bchan_share_state(b);
+    worker_arg prod = {s, b, mode, count, 0, 0};
+    worker_arg cons = {s2, b2, mode, count, 0, 0};
+    pthread_t threads[2];
+
+    start = now();
+    pthread_create(&threads[0], NULL, producer, &prod);
+    pthread_create(&threads[1], NULL, consumer, &cons);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    double elapsed = now() - start;
+    errors += cons.errors;
+    errors += chan_pop(s2, &data);
+    errors += bchan_peek(b2, &len) != NULL;
+    chan_free(s);
+    chan_free(s2);
+    bchan_free(b);
+    bchan_free(b2);
+
+    printf("%-10s %.3fs, %.1fM msgs/s, consumer cpu %.3fs\n",
+           names[mode], elapsed, count / elapsed * 1e-6, cons.cpu);
+  }
+
+  // attaching checks the channel, memfd descriptors work as names
+  errors += bchan_shm_attach("/chan-test-missing") != NULL;
+  int fd = memfd_create("chan-test", 0);
+  errors += bchan_fd_attach(fd) != NULL;
+  b = bchan_fd_create(fd, 100);
+  bchan_state* b2 = bchan_fd_attach(fd);
+  close(fd);
+  errors += !b || !b2 || bchan_share_state(b) != NULL;
+  errors += !bchan_send(b, "0123456789", 10);
+  errors += memcmp(bchan_peek_wait(b2, &len, 0), "0123456789", 10) || len != 10;
+  bchan_release(b2);
+  bchan_free(b);
+  bchan_free(b2);
+
+  errors += recv_shm(count / 10, capacity * sizeof(void*) < 512
+                                 ? 512 : capacity * sizeof(void*));
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,169 @@
+/* Compare the implementations of hash/crc32.h on random buffers of every
+ * length and alignment up to a few blocks and on a few longer ones, whole,
+ * fed by random pieces to the streaming functions and combined from two
+ * parts, and time them on a large buffer, then hashn on several threads.
+ * Hardware versions are only checked when the cpu supports them.
+ * Usage: ./crc32 [buffer size in MB]
+ * Exits with 1 if any implementation differs from the bitwise one. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define CRC32_IMPLEMENTATION
+#include "../hash/crc32.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+typedef uint32_t (*hash_fn)(const uint8_t*, size_t);
+
+typedef struct {
+  const char* name;
+  hash_fn fn;
+  int supported;
+  // CRC-32C rather than CRC-32
+  int castagnoli;
+} implementation;
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// reference CRC-32C, same loop as crc32_bitwise
+uint32_t crc32c_bitwise(const uint8_t* content, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= content[i];
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+// crc of a buffer cut in random pieces
+uint32_t crc32_pieces(const uint8_t* content, size_t length, int castagnoli) {
+  crc32_state state;
+  if (castagnoli) {
+    crc32c_init(&state);
+  } else {
+    crc32_init(&state);
+  }
+  while (length) {
+    size_t n = next() % 40;
+    n = n < length ? n : length;
+    if (castagnoli) {
+      crc32c_update(&state, content, n);
+    } else {
+      crc32_update(&state, content, n);
+    }
+    content += n;
+    length -= n;
+  }
+  return castagnoli ? crc32c_final(&state) : crc32_final(&state);
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+  implementation impls[] = {
+    {"bitwise", crc32_bitwise, 1, 0},
+    {"slice8", crc32_slice8, 1, 0},
+    {"slice16", crc32_slice16, 1, 0},
+#ifdef CRC32_X86
+    {"pclmul", crc32_pclmul, __builtin_cpu_supports("pclmul"), 0},
+#endif
+    {"hashn", hashn, 1, 0},
+    {"crc32c bitwise", crc32c_bitwise, 1, 1},
+    {"crc32c portable", crc32c_portable, 1, 1},
+#ifdef CRC32_X86
+    {"crc32c sse42", crc32c_sse42, __builtin_cpu_supports("sse4.2"), 1},
+#endif
+    {"crc32c", crc32c, 1, 1},
+  };
+  int nimpls = sizeof(impls) / sizeof(impls[0]);
+  // crossing the blocks of the three streams of crc32c
+  size_t lengths[] = {
+    255, 256, 767, 768, 769, 1000, 24575, 24576, 24577, 30000, 100000
+  };
+  uint8_t* buf = malloc(size + 64);
+  long errors = 0;
+  uint32_t expected[2];
+  seed(42);
+  for (size_t i = 0; i < size + 64; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  // standard check values
+  errors += hash("123456789") != 0xCBF43926;
+  errors += hash("") != 0;
+  errors += hash("The quick brown fox jumps over the lazy dog") != 0x414FA339;
+  errors += crc32c((const uint8_t*)"123456789", 9) != 0xE3069283;
+
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length < 300 + sizeof(lengths) / sizeof(size_t);
+         length++) {
+      size_t n = length < 300 ? length : lengths[length - 300];
+      expected[0] = crc32_bitwise(buf + offset, n);
+      expected[1] = crc32c_bitwise(buf + offset, n);
+      errors += crc32_pieces(buf + offset, n, 0) != expected[0];
+      errors += crc32_pieces(buf + offset, n, 1) != expected[1];
+      size_t cut = n ? next() % (n + 1) : 0;
+      errors += crc32_combine(crc32_bitwise(buf + offset, cut),
+                              crc32_slice16(buf + offset + cut, n - cut),
+                              n - cut) != expected[0];
+      errors += crc32c_combine(crc32c_portable(buf + offset, cut),
+                               crc32c_portable(buf + offset + cut, n - cut),
+                               n - cut) != expected[1];
+      for (int i = 0; i < nimpls; i++) {
+        if (impls[i].supported
+            && impls[i].fn(buf + offset, n) != expected[impls[i].castagnoli]) {
+          printf("%s differs on %zu bytes at offset %zu\n", impls[i].name,
+                 n, offset);
+          errors++;
+        }
+      }
+    }
+  }
+
+  printf("%zuMB buffer\n", size >> 20);
+  expected[0] = crc32_slice16(buf + 1, size);
+  expected[1] = crc32c_portable(buf + 1, size);
+  for (int i = 0; i < nimpls; i++) {
+    if (!impls[i].supported) {
+      printf("%-16s not supported\n", impls[i].name);
+      continue;
+    }
+    double start = now();
+    uint32_t crc = impls[i].fn(buf + 1, size);
+    double elapsed = now() - start;
+    errors += crc != expected[impls[i].castagnoli];
+    printf("%-16s %.3fs, %7.1f MB/s\n", impls[i].name, elapsed,
+           size / elapsed * 1e-6);
+  }
+
+  // no thread for a count below 2
+  for (int nthreads = -1; nthreads <= 1; nthreads++) {
+    errors += hashn_parallel(buf + 1, size, nthreads) != expected[0];
+  }
+
+  // threads hash parts of the buffer, fewer for smaller buffers
+  for (int nthreads = 2; nthreads <= 8; nthreads *= 2) {
+    double start = now();
+    uint32_t parallel = hashn_parallel(buf + 1, size, nthreads);
+    double elapsed = now() - start;
+    errors += parallel != expected[0];
+    errors += hashn_parallel(buf + 1, 1000000, nthreads)
+      != hashn(buf + 1, 1000000);
+    printf("%d threads  %.3fs, %7.1f MB/s\n", nthreads, elapsed,
+           size / elapsed * 1e-6);
+  }
+
+  free(buf);
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
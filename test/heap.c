@@ -0,0 +1,204 @@
+/* Comparison of structures/heap.h with structures/avl.h used as a priority
+ * queue (smallest node popped), on the same boxed keys, with and without
+ * decrease-key, then pushes failing for lack of memory.
+ * Usage: ./heap [number of keys]
+ * Exits with 1 if both queues do not pop the same sequence. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define AVL_IMPLEMENTATION
+#include "../structures/avl.h"
+#include <stdlib.h>
+
+/* the heap reallocates through this, failing when fail_realloc is set */
+int fail_realloc = 0;
+void* test_realloc(void* p, size_t size) {
+  return fail_realloc ? NULL : realloc(p, size);
+}
+#define realloc(p, size) test_realloc(p, size)
+#define HEAP_IMPLEMENTATION
+#include "../structures/heap.h"
+#undef realloc
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+/* low bits of keys hold the index so that keys are unique for the avl */
+#define INDEX_BITS 20
+#define INDEX_MASK ((1UL << INDEX_BITS) - 1)
+
+int u64cmp(const void* key1, const void* key2) {
+  uint64_t val1 = *(const uint64_t *)key1;
+  uint64_t val2 = *(const uint64_t *)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+uint64_t* box(uint64_t v) {
+  uint64_t* b = malloc(sizeof(uint64_t));
+  *b = v;
+  return b;
+}
+
+double since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* remove the smallest node of the tree and return its data */
+void* avl_pop(AvlTree* t) {
+  AvlTreeNode* node = t->root;
+  uint64_t key;
+  if (!node) {
+    return NULL;
+  }
+  while (node->left) {
+    node = node->left;
+  }
+  key = *(uint64_t *)node->key;
+  return avl_remove(t, &key);
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  uint64_t* keys,* initial;
+  size_t* handles;
+  void** popped;
+  AvlTree avl;
+  Heap heap;
+  clock_t start;
+  size_t i, j;
+  uint64_t last;
+  const void* top;
+  int errors = 0, indexed;
+
+  if (n > INDEX_MASK) {
+    n = INDEX_MASK;
+  }
+  keys = malloc(n * sizeof(uint64_t));
+  initial = malloc(n * sizeof(uint64_t));
+  handles = malloc(n * sizeof(size_t));
+  popped = malloc(n * sizeof(void*));
+
+  seed(42);
+  for (i = 0; i < n; i++) {
+    keys[i] = (next() >> INDEX_BITS << INDEX_BITS) | i;
+  }
+
+  printf("%zu keys\n", n);
+  printf("%-14s %10s %10s\n", "", "avl", "heap");
+
+  avl_initialize(&avl, u64cmp, free);
+  heap_initialize(&heap, u64cmp, free, 0);
+
+  printf("%-14s", "push");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    avl_insert(&avl, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  for (i = 0; i < n; i++) {
+    heap_push(&heap, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  printf(" %9.3fs\n", since(start));
+
+  printf("%-14s", "pop");
+  start = clock();
+  for (i = 0; i < n; i++) {
+    popped[i] = avl_pop(&avl);
+  }
+  printf(" %9.3fs", since(start));
+  start = clock();
+  last = 0;
+  for (i = 0; i < n; i++) {
+    heap_peek(&heap, &top);
+    errors += *(const uint64_t *)top < last;
+    last = *(const uint64_t *)top;
+    errors += heap_pop(&heap) != popped[i];
+  }
+  printf(" %9.3fs\n", since(start));
+  errors += avl_pop(&avl) != NULL || heap_pop(&heap) != NULL;
+
+  /* decrease n random keys, a key may be decreased several times */
+  heap_destroy(&heap, NULL);
+  heap_initialize(&heap, u64cmp, free, 1);
+  for (i = 0; i < n; i++) {
+    avl_insert(&avl, box(keys[i]), (void *)(uintptr_t)(i + 1));
+    handles[i] = heap_push(&heap, box(keys[i]), (void *)(uintptr_t)(i + 1));
+  }
+  memcpy(initial, keys, n * sizeof(uint64_t));
+
+  printf("%-14s", "decrease-key");
+  seed(43);
+  start = clock();
+  for (i = 0; i < n; i++) {
+    j = next() % n;
+    avl_remove(&avl, &keys[j]);
+    keys[j] = ((keys[j] >> INDEX_BITS) / 2 << INDEX_BITS) | j;
+    avl_insert(&avl, box(keys[j]), (void *)(uintptr_t)(j + 1));
+  }
+  printf(" %9.3fs", since(start));
+  /* same sequence of keys */
+  memcpy(keys, initial, n * sizeof(uint64_t));
+  seed(43);
+  start = clock();
+  for (i = 0; i < n; i++) {
+    j = next() % n;
+    keys[j] = ((keys[j] >> INDEX_BITS) / 2 << INDEX_BITS) | j;
+    heap_update(&heap, handles[j], box(keys[j]));
+  }
+  printf(" %9.3fs\n", since(start));
+
+  /* remove one key in eight through its handle */
+  for (i = 0; i < n; i += 8) {
+    errors += avl_remove(&avl, &keys[i]) != (void *)(uintptr_t)(i + 1);
+    errors += heap_remove(&heap, handles[i]) != (void *)(uintptr_t)(i + 1);
+  }
+
+  errors += heap_size(&heap) != n - (n + 7) / 8;
+  while ((popped[0] = avl_pop(&avl))) {
+    errors += heap_pop(&heap) != popped[0];
+  }
+  errors += heap_size(&heap) != 0;
+
+  /* handles are reused and the heap is usable after destroy */
+  errors += heap_push(&heap, box(1), (void *)1) >= n;
+  heap_destroy(&heap, NULL);
+  heap_initialize(&heap, u64cmp, free, 1);
+  errors += heap_push(&heap, box(2), (void *)2) != 0;
+  errors += heap_push(&heap, box(1), (void *)1) != 1;
+  heap_update(&heap, 0, box(0));
+  errors += heap_peek(&heap, NULL) != (void *)2;
+  heap_destroy(&heap, NULL);
+
+  /* a full heap cannot grow, indexed or not, and is left unchanged */
+  for (indexed = 0; indexed < 2; indexed++) {
+    uint64_t key = 5;
+    heap_initialize(&heap, u64cmp, free, indexed);
+    fail_realloc = 1;
+    errors += heap_push(&heap, &key, (void *)1) != HEAP_NO_MEMORY;
+    fail_realloc = 0;
+    for (i = 0; i < HEAP_MIN_CAPACITY; i++) {
+      errors += heap_push(&heap, box(i + 10), (void *)1) == HEAP_NO_MEMORY;
+    }
+    fail_realloc = 1;
+    errors += heap_push(&heap, &key, (void *)2) != HEAP_NO_MEMORY;
+    fail_realloc = 0;
+    errors += heap_size(&heap) != HEAP_MIN_CAPACITY;
+    errors += heap_push(&heap, box(key), (void *)2) == HEAP_NO_MEMORY;
+    errors += heap_pop(&heap) != (void *)2;
+    heap_destroy(&heap, NULL);
+  }
+
+  avl_destroy(&avl, NULL);
+  free(keys);
+  free(initial);
+  free(handles);
+  free(popped);
+
+  if (errors) {
+    printf("%d errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,230 @@
+/* Compare hash/lch32.h with its original one-shot version on random
+ * buffers, whole, fed by random pieces to the streaming functions and in
+ * batches of short messages to each version of hashn_many. Times them on a
+ * large buffer, then hashn and hashn_many on the words of
+ * test/all_english_words.txt.
+ * Usage: ./lch32 [buffer size in MB]
+ * Exits with 1 if any digest differs from the original. */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define LCH32_IMPLEMENTATION
+#include "../hash/lch32.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+#define MAX_WORDS 300000
+#define BATCH 1000
+
+typedef void (*many_fn)(const uint8_t* const*, const size_t*, size_t,
+                        uint32_t*);
+
+typedef struct {
+  const char* name;
+  many_fn fn;
+  int supported;
+} implementation;
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+uint32_t rotl32(uint32_t x, int k) {
+  return (x << k) | (x >> (32 - k));
+}
+
+// hashn as first written, rotations on 32 bits
+uint32_t reference(const uint8_t* content, size_t length) {
+  uint32_t buf[3] = { 0x51b73064, 0x9f4a5705, 0x7b049943 };
+  uint32_t digest = 0x698a3c57;
+
+  for (size_t i = 0; i < length; i += 2) {
+    uint8_t a = content[i];
+    uint8_t b = (i + 1 < length) ? content[i + 1] : content[i % length];
+    uint16_t block1 = a | (b << 8);
+    uint32_t block2 = rotl32(block1, 5);
+
+    uint64_t t = buf[2] + buf[0];
+    buf[1] ^= block1 | (block2 << 16);
+
+    buf[2] ^= buf[0];
+    digest ^= buf[1];
+    buf[1] ^= buf[2];
+    buf[0] ^= digest;
+
+    buf[0] ^= t;
+
+    digest = rotl32(digest, 23);
+  }
+  return digest;
+}
+
+// digest of a buffer cut in random pieces
+uint32_t lch32_pieces(const uint8_t* content, size_t length) {
+  lch32_state state;
+  lch32_init(&state);
+  while (length) {
+    size_t n = next() % 40;
+    n = n < length ? n : length;
+    lch32_update(&state, content, n);
+    content += n;
+    length -= n;
+  }
+  return lch32_final(&state);
+}
+
+// hashn_many on batches of random messages of up to max_length bytes, from
+// 1 to BATCH messages so that the last group of lanes is partial
+long check_many(many_fn fn, const uint8_t* buf, size_t max_length) {
+  const uint8_t* contents[BATCH];
+  size_t lengths[BATCH];
+  uint32_t out[BATCH];
+  long errors = 0;
+  for (size_t n = 1; n <= BATCH; n = n * 3 + 1) {
+    for (size_t i = 0; i < n; i++) {
+      contents[i] = buf + next() % 4096;
+      lengths[i] = next() % (max_length + 1);
+    }
+    fn(contents, lengths, n, out);
+    for (size_t i = 0; i < n; i++) {
+      errors += out[i] != reference(contents[i], lengths[i]);
+    }
+  }
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 16) << 20;
+  size_t lengths[] = { 1000, 5551, 5552, 5553, 100000 };
+  implementation impls[] = {
+#ifdef LCH32_X86
+    {"sse2", lch32_many_sse2, 1},
+    {"avx2", lch32_many_avx2, __builtin_cpu_supports("avx2")},
+    {"avx512", lch32_many_avx512, __builtin_cpu_supports("avx512f")},
+#endif
+    {"hashn_many", hashn_many, 1},
+  };
+  int nimpls = sizeof(impls) / sizeof(impls[0]);
+  uint8_t* buf = malloc(size + 64);
+  long errors = 0;
+
+  seed(42);
+  for (size_t i = 0; i < size + 64; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  errors += hash("Wikipedia") != reference((const uint8_t*)"Wikipedia", 9);
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t length = 0; length < 300 + sizeof(lengths) / sizeof(size_t);
+         length++) {
+      size_t n = length < 300 ? length : lengths[length - 300];
+      uint32_t expected = reference(buf + offset, n);
+      errors += hashn(buf + offset, n) != expected;
+      errors += lch32_pieces(buf + offset, n) != expected;
+    }
+  }
+
+  // same lengths, mixed short and long ones, a single message
+  for (int i = 0; i < nimpls; i++) {
+    if (!impls[i].supported) {
+      continue;
+    }
+    long failed = check_many(impls[i].fn, buf, 40)
+      + check_many(impls[i].fn, buf, 0) + check_many(impls[i].fn, buf, 300);
+    size_t same[BATCH];
+    const uint8_t* contents[BATCH];
+    uint32_t out[BATCH];
+    for (size_t j = 0; j < BATCH; j++) {
+      same[j] = 17;
+      contents[j] = buf + j;
+    }
+    impls[i].fn(contents, same, BATCH, out);
+    for (size_t j = 0; j < BATCH; j++) {
+      failed += out[j] != reference(buf + j, 17);
+    }
+    if (failed) {
+      printf("%s differs on %ld messages\n", impls[i].name, failed);
+    }
+    errors += failed;
+  }
+
+  printf("%zuMB buffer\n", size >> 20);
+  double start = now();
+  uint32_t expected = reference(buf + 1, size);
+  double elapsed = now() - start;
+  printf("%-10s %.3fs, %7.1f MB/s\n", "original", elapsed,
+         size / elapsed * 1e-6);
+  start = now();
+  errors += hashn(buf + 1, size) != expected;
+  elapsed = now() - start;
+  printf("%-10s %.3fs, %7.1f MB/s\n", "hashn", elapsed,
+         size / elapsed * 1e-6);
+  free(buf);
+
+  // words as the keys of a table
+  FILE* f = fopen("test/all_english_words.txt", "r");
+  if (!f) {
+    f = fopen("all_english_words.txt", "r");
+  }
+  if (!f) {
+    printf("all_english_words.txt not found\n");
+    return 1;
+  }
+  const uint8_t** words = malloc(MAX_WORDS * sizeof(uint8_t*));
+  size_t* sizes = malloc(MAX_WORDS * sizeof(size_t));
+  uint32_t* digests = malloc(MAX_WORDS * sizeof(uint32_t));
+  char line[256];
+  size_t nwords = 0;
+  while (nwords < MAX_WORDS && fgets(line, sizeof(line), f)) {
+    sizes[nwords] = strcspn(line, "\r\n");
+    uint8_t* word = malloc(sizes[nwords] + 1);
+    memcpy(word, line, sizes[nwords] + 1);
+    words[nwords++] = word;
+  }
+  fclose(f);
+
+  uint32_t sum = 0;
+  start = now();
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < nwords; i++) {
+      sum += hashn(words[i], sizes[i]);
+    }
+  }
+  elapsed = now() - start;
+  printf("%-10s %zu words: %5.1f ns per key (%x)\n", "hashn", nwords,
+         elapsed / nwords / 10 * 1e9, sum & 0xF);
+  for (int i = 0; i < nimpls; i++) {
+    if (!impls[i].supported) {
+      printf("%-10s not supported\n", impls[i].name);
+      continue;
+    }
+    start = now();
+    for (int round = 0; round < 10; round++) {
+      impls[i].fn(words, sizes, nwords, digests);
+    }
+    elapsed = now() - start;
+    long failed = 0;
+    for (size_t j = 0; j < nwords; j++) {
+      failed += digests[j] != hashn(words[j], sizes[j]);
+    }
+    errors += failed;
+    printf("%-10s %zu words: %5.1f ns per key\n", impls[i].name, nwords,
+           elapsed / nwords / 10 * 1e9);
+  }
+
+  for (size_t i = 0; i < nwords; i++) {
+    free((uint8_t*)words[i]);
+  }
+  free(words);
+  free(sizes);
+  free(digests);
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+/* Threads recycle buffers through a shared free list, with
+ * structures/lfstack.h and with structures/stack.h behind a mutex. Each
+ * thread pops a buffer, writes to it and pushes it back. Afterwards every
+ * buffer must be in the stack exactly once.
+ * Usage: ./lfstack [operations per thread] [max threads]
+ * Exits with 1 on inconsistencies. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LFS_IMPLEMENTATION
+#include "../structures/lfstack.h"
+#define STK_IMPLEMENTATION
+#include "../structures/stack.h"
+
+#define BUFFERS 64
+
+typedef struct {
+  StkElem elem;
+  long owner;
+} Buffer;
+
+typedef struct {
+  LfStack* lfs;
+  Stack* stack;
+  pthread_mutex_t* mutex;
+  long id, ops, errors;
+} worker_arg;
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void* worker(void* p) {
+  worker_arg* arg = p;
+  Buffer* buf;
+  for (long i = 0; i < arg->ops; i++) {
+    if (arg->lfs) {
+      buf = (Buffer*)lfs_pop(arg->lfs);
+    } else {
+      pthread_mutex_lock(arg->mutex);
+      buf = stk_pop(arg->stack);
+      pthread_mutex_unlock(arg->mutex);
+    }
+    if (!buf) {
+      continue;
+    }
+    // nobody else may hold it
+    buf->owner = arg->id;
+    arg->errors += buf->owner != arg->id;
+    buf->owner = -1;
+    if (arg->lfs) {
+      lfs_push(arg->lfs, &buf->elem);
+    } else {
+      pthread_mutex_lock(arg->mutex);
+      stk_push(arg->stack, buf);
+      pthread_mutex_unlock(arg->mutex);
+    }
+  }
+  return NULL;
+}
+
+// run the workload on one stack, return the number of errors
+long run(LfStack* lfs, Stack* stack, int nthreads, long ops,
+         double* elapsed) {
+  pthread_t threads[nthreads];
+  worker_arg args[nthreads];
+  pthread_mutex_t mutex;
+  long errors = 0;
+
+  pthread_mutex_init(&mutex, NULL);
+  double start = now();
+  for (int i = 0; i < nthreads; i++) {
+    args[i] = (worker_arg){lfs, stack, &mutex, i, ops, 0};
+    pthread_create(&threads[i], NULL, worker, &args[i]);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    errors += args[i].errors;
+  }
+  *elapsed = now() - start;
+  pthread_mutex_destroy(&mutex);
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  long ops = argc > 1 ? atol(argv[1]) : 1000000;
+  int maxthreads = argc > 2 ? atoi(argv[2]) : 8;
+  Buffer buffers[BUFFERS];
+  int seen[BUFFERS];
+  long errors = 0;
+  double tl, tm;
+  LfStack lfs;
+  Stack stack = {0};
+  Buffer* buf;
+
+  printf("%ld pop/push per thread, %d buffers\n", ops, BUFFERS);
+  printf("%-8s %14s %14s\n", "threads", "lfstack ops/s", "mutex ops/s");
+
+  for (int nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+    lfs_initialize(&lfs);
+    for (int i = 0; i < BUFFERS; i++) {
+      buffers[i].owner = -1;
+      lfs_push(&lfs, &buffers[i].elem);
+      stk_push(&stack, &buffers[i]);
+    }
+
+    errors += run(&lfs, NULL, nthreads, ops, &tl);
+    errors += run(NULL, &stack, nthreads, ops, &tm);
+    printf("%-8d %14.0f %14.0f\n", nthreads,
+           2 * nthreads * ops / tl, 2 * nthreads * ops / tm);
+
+    for (int i = 0; i < BUFFERS; i++) {
+      seen[i] = 0;
+    }
+    while ((buf = (Buffer*)lfs_pop(&lfs))) {
+      seen[buf - buffers]++;
+    }
+    for (int i = 0; i < BUFFERS; i++) {
+      errors += seen[i] != 1;
+    }
+    errors += !lfs_empty(&lfs);
+    while (stk_pop(&stack)) {
+    }
+  }
+  stk_destroy(&stack);
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,365 @@
+/* Producers send numbered messages through the mpsc and mpmc channels of
+ * structures/chan.h, with 1 to 8 producers and 1 (mpsc) or 2 (mpmc)
+ * consumers, then through one spsc channel each to a consumer waiting on
+ * all of them with a selector, and to a consumer freeing its selector after
+ * each wait while they still send. Consumers check that each message
+ * arrives once, and in order for each producer with mpsc and spsc. Reports
+ * throughput and the mean latency of one message in 256, timestamped by
+ * its producer.
+ * Usage: ./mchan [messages per run] [capacity]
+ * Exits with 1 if a message is lost, duplicated or out of order. */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define CHAN_IMPL
+#include "../structures/chan.h"
+
+#define MAX_PRODUCERS 8
+#define CONSUMERS 2
+// producer of a message in the high bits, sequence number in the low bits
+#define SEQ_BITS 40
+#define SAMPLE 256
+
+typedef struct {
+  mpsc_state* mpsc;
+  mpmc_state* mpmc;
+  long id, count;
+  // send times of sampled messages
+  int64_t* sent;
+} producer_arg;
+
+typedef struct {
+  mpsc_state* mpsc;
+  mpmc_state* mpmc;
+  atomic_long* received;
+  long total, errors;
+  int64_t** sent;
+  // next sequence number of each producer (mpsc), or count and sum (mpmc)
+  long next[MAX_PRODUCERS];
+  long sum[MAX_PRODUCERS];
+  double latency;
+  long samples;
+} consumer_arg;
+
+int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void* producer(void* p) {
+  producer_arg* arg = p;
+  for (long i = 0; i < arg->count; i++) {
+    void* msg = (void*)(uintptr_t)(((uint64_t)arg->id << SEQ_BITS) | i);
+    if (i % SAMPLE == 0) {
+      arg->sent[i / SAMPLE] = now_ns();
+    }
+    if (arg->mpsc) {
+      mpsc_push_wait(arg->mpsc, msg, -1);
+    } else {
+      mpmc_push_wait(arg->mpmc, msg, -1);
+    }
+  }
+  return NULL;
+}
+
+void* consumer(void* p) {
+  consumer_arg* arg = p;
+  void* data;
+  bool done;
+  while (atomic_load(arg->received) < arg->total) {
+    // time out to notice when other consumers got the last messages
+    if (arg->mpsc) {
+      done = mpsc_pop_wait(arg->mpsc, &data, 10000000);
+    } else {
+      done = mpmc_pop_wait(arg->mpmc, &data, 10000000);
+    }
+    if (!done) {
+      continue;
+    }
+    atomic_fetch_add(arg->received, 1);
+    uint64_t id = (uintptr_t)data >> SEQ_BITS;
+    long seq = (long)((uintptr_t)data & (((uint64_t)1 << SEQ_BITS) - 1));
+    if (id >= MAX_PRODUCERS) {
+      arg->errors++;
+      continue;
+    }
+    if (seq % SAMPLE == 0) {
+      arg->latency += now_ns() - arg->sent[id][seq / SAMPLE];
+      arg->samples++;
+    }
+    if (arg->mpsc) {
+      arg->errors += seq != arg->next[id];
+      arg->next[id] = seq + 1;
+    } else {
+      arg->next[id]++;
+      arg->sum[id] += seq;
+    }
+  }
+  return NULL;
+}
+
+// send count messages from nproducers threads, return the number of errors
+long run(bool mpsc, int nproducers, long count, size_t capacity) {
+  int nconsumers = mpsc ? 1 : CONSUMERS;
+  producer_arg prods[MAX_PRODUCERS];
+  consumer_arg cons[CONSUMERS];
+  pthread_t threads[MAX_PRODUCERS + CONSUMERS];
+  int64_t* sent[MAX_PRODUCERS];
+  atomic_long received = 0;
+  long per_producer = count / nproducers;
+  long errors = 0;
+
+  mpsc_state* s = mpsc ? mpsc_new_state(capacity) : NULL;
+  mpmc_state* m = mpsc ? NULL : mpmc_new_state(capacity);
+  for (int i = 0; i < nproducers; i++) {
+    sent[i] = malloc((per_producer / SAMPLE + 1) * sizeof(int64_t));
+    prods[i] = (producer_arg){
+      s ? mpsc_share_state(s) : NULL, m ? mpmc_share_state(m) : NULL,
+      i, per_producer, sent[i]
+    };
+  }
+  for (int i = 0; i < nconsumers; i++) {
+    memset(&cons[i], 0, sizeof(consumer_arg));
+    cons[i].mpsc = s ? mpsc_share_state(s) : NULL;
+    cons[i].mpmc = m ? mpmc_share_state(m) : NULL;
+    cons[i].received = &received;
+    cons[i].total = per_producer * nproducers;
+    cons[i].sent = sent;
+  }
+
+  int64_t start = now_ns();
+  for (int i = 0; i < nconsumers; i++) {
+    pthread_create(&threads[i], NULL, consumer, &cons[i]);
+  }
+  for (int i = 0; i < nproducers; i++) {
+    pthread_create(&threads[nconsumers + i], NULL, producer, &prods[i]);
+  }
+  for (int i = 0; i < nconsumers + nproducers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = (now_ns() - start) * 1e-9;
+
+  double latency = 0;
+  long samples = 0;
+  for (int i = 0; i < nconsumers; i++) {
+    errors += cons[i].errors;
+    latency += cons[i].latency;
+    samples += cons[i].samples;
+  }
+  // each message of each producer once
+  for (int p = 0; p < nproducers; p++) {
+    long n = 0, sum = 0;
+    for (int i = 0; i < nconsumers; i++) {
+      n += cons[i].next[p];
+      sum += cons[i].sum[p];
+    }
+    if (mpsc) {
+      errors += n != per_producer;
+    } else {
+      errors += n != per_producer;
+      errors += sum != per_producer * (per_producer - 1) / 2;
+    }
+  }
+
+  printf("%-6s %d producers: %.3fs, %5.1fM msgs/s, latency %8.1fus\n",
+         mpsc ? "mpsc" : "mpmc", nproducers, elapsed,
+         per_producer * nproducers / elapsed * 1e-6,
+         samples ? latency / samples * 1e-3 : 0.);
+
+  for (int i = 0; i < nproducers; i++) {
+    if (s) {
+      mpsc_free(prods[i].mpsc);
+    } else {
+      mpmc_free(prods[i].mpmc);
+    }
+    free(sent[i]);
+  }
+  for (int i = 0; i < nconsumers; i++) {
+    if (s) {
+      mpsc_free(cons[i].mpsc);
+    } else {
+      mpmc_free(cons[i].mpmc);
+    }
+  }
+  if (s) {
+    mpsc_free(s);
+  } else {
+    mpmc_free(m);
+  }
+  return errors;
+}
+
+typedef struct {
+  chan_state* chan;
+  long count;
+  // pause after each message, so that the consumer parks
+  long pause_ns;
+} spsc_arg;
+
+void* spsc_producer(void* p) {
+  spsc_arg* arg = p;
+  struct timespec pause = {0, arg->pause_ns};
+  for (long i = 0; i < arg->count; i++) {
+    chan_push_wait(arg->chan, (void*)(uintptr_t)i, -1);
+    if (arg->pause_ns) {
+      nanosleep(&pause, NULL);
+    }
+  }
+  return NULL;
+}
+
+// nproducers send to one consumer through a selector
+long run_select(int nproducers, long count, size_t capacity) {
+  chan_selector* sel = chan_selector_new();
+  chan_state* chans[MAX_PRODUCERS];
+  spsc_arg args[MAX_PRODUCERS];
+  pthread_t threads[MAX_PRODUCERS];
+  long next[MAX_PRODUCERS] = {0};
+  long per_producer = count / nproducers;
+  long errors = 0, received = 0;
+  void* batch[64];
+  int ready[MAX_PRODUCERS];
+
+  for (int i = 0; i < nproducers; i++) {
+    chans[i] = chan_new_state(capacity);
+    errors += chan_select_add(sel, chans[i]) != i;
+    args[i] = (spsc_arg){chan_share_state(chans[i]), per_producer, 0};
+  }
+  int64_t start = now_ns();
+  for (int i = 0; i < nproducers; i++) {
+    pthread_create(&threads[i], NULL, spsc_producer, &args[i]);
+  }
+  while (received < per_producer * nproducers) {
+    size_t n = chan_select_n(sel, ready, MAX_PRODUCERS, -1);
+    for (size_t k = 0; k < n; k++) {
+      int c = ready[k];
+      size_t got = chan_pop_n(chans[c], batch, 64);
+      errors += !got;
+      for (size_t j = 0; j < got; j++) {
+        errors += (uintptr_t)batch[j] != (uintptr_t)next[c]++;
+      }
+      received += got;
+    }
+  }
+  for (int i = 0; i < nproducers; i++) {
+    pthread_join(threads[i], NULL);
+    chan_free(args[i].chan);
+  }
+  double elapsed = (now_ns() - start) * 1e-9;
+  printf("%-6s %d producers: %.3fs, %5.1fM msgs/s\n", "select", nproducers,
+         elapsed, received / elapsed * 1e-6);
+
+  chan_selector_free(sel);
+  for (int i = 0; i < nproducers; i++) {
+    chan_free(chans[i]);
+  }
+  return errors;
+}
+
+// producers keep sending while the consumer makes a new selector for each
+// wait and frees it at once, so that producers wake up selectors being
+// freed
+long run_select_free(int nproducers, long count) {
+  chan_state* chans[MAX_PRODUCERS];
+  spsc_arg args[MAX_PRODUCERS];
+  pthread_t threads[MAX_PRODUCERS];
+  long next[MAX_PRODUCERS] = {0};
+  long per_producer = count / nproducers;
+  long errors = 0, received = 0, rounds = 0;
+  void* batch[64];
+  int ready[MAX_PRODUCERS];
+
+  for (int i = 0; i < nproducers; i++) {
+    chans[i] = chan_new_state(4);
+    args[i] = (spsc_arg){chan_share_state(chans[i]), per_producer, 1000};
+    pthread_create(&threads[i], NULL, spsc_producer, &args[i]);
+  }
+  while (received < per_producer * nproducers) {
+    chan_selector* sel = chan_selector_new();
+    for (int i = 0; i < nproducers; i++) {
+      errors += chan_select_add(sel, chans[i]) != i;
+    }
+    size_t n = chan_select_n(sel, ready, MAX_PRODUCERS, 1000000);
+    chan_selector_free(sel);
+    rounds++;
+    for (size_t k = 0; k < n; k++) {
+      int c = ready[k];
+      size_t got = chan_pop_n(chans[c], batch, 64);
+      for (size_t j = 0; j < got; j++) {
+        errors += (uintptr_t)batch[j] != (uintptr_t)next[c]++;
+      }
+      received += got;
+    }
+  }
+  for (int i = 0; i < nproducers; i++) {
+    pthread_join(threads[i], NULL);
+    chan_free(args[i].chan);
+    chan_free(chans[i]);
+  }
+  printf("%-6s %d producers: %ld selectors freed\n", "free", nproducers,
+         rounds);
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  long count = argc > 1 ? strtol(argv[1], NULL, 10) : 4000000;
+  size_t capacity = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+  long errors = 0;
+  void* data;
+
+  // full and empty rings, several rounds
+  mpmc_state* m = mpmc_new_state(3);
+  for (int round = 0; round < 3; round++) {
+    for (uintptr_t i = 0; i < 4; i++) {
+      errors += !mpmc_push(m, (void*)(i + 1));
+    }
+    errors += mpmc_push(m, (void*)5);
+    for (uintptr_t i = 0; i < 4; i++) {
+      errors += !mpmc_pop(m, &data) || data != (void*)(i + 1);
+    }
+    errors += mpmc_pop(m, &data) || data != NULL;
+  }
+  errors += mpmc_pop_wait(m, &data, 1000000);
+  mpmc_free(m);
+
+  // selectors time out and go round the ready channels
+  chan_selector* sel = chan_selector_new();
+  chan_state* c0 = chan_new_state(4);
+  mpsc_state* c1 = mpsc_new_state(4);
+  errors += chan_select_add(sel, c0) != 0 || mpsc_select_add(sel, c1) != 1;
+  errors += chan_select_add(sel, c0) != -1;
+  int64_t start = now_ns();
+  errors += chan_select(sel, 5000000) != -1;
+  errors += now_ns() - start < 5000000;
+  chan_push(c0, (void*)1);
+  mpsc_push(c1, (void*)2);
+  errors += chan_select(sel, 0) != 0 || chan_select(sel, 0) != 1;
+  errors += chan_select(sel, 0) != 0;
+  errors += !mpsc_pop(c1, &data) || chan_select(sel, -1) != 0;
+  // the selector keeps the channels alive
+  chan_free(c0);
+  mpsc_free(c1);
+  chan_selector_free(sel);
+
+  printf("%ld messages, capacity %zu\n", count, capacity);
+  for (int mpsc = 1; mpsc >= 0; mpsc--) {
+    for (int n = 1; n <= MAX_PRODUCERS; n *= 2) {
+      errors += run(mpsc, n, count, capacity);
+    }
+  }
+  for (int n = 1; n <= MAX_PRODUCERS; n *= 2) {
+    errors += run_select(n, count, capacity);
+  }
+  errors += run_select_free(MAX_PRODUCERS, count / 100);
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* Readers check that every snapshot of structures/pavl.h is a valid AVL tree
+ * while a writer inserts then removes keys. As long as keys are inserted
+ * and removed in increasing order, the keys of a snapshot must also be a
+ * range [lo, hi) of integers.
+ * Usage: ./pavl [number of keys] [number of readers]
+ * Exits with 1 on inconsistencies. */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define PAVL_IMPLEMENTATION
+#include "../structures/pavl.h"
+
+typedef struct {
+  PavlTree* tree;
+  atomic_int* done;
+  atomic_int* in_order;
+  long snapshots;
+  long errors;
+} reader_arg;
+
+int intcmp(const void* key1, const void* key2) {
+  int val1 = *(const int *)key1;
+  int val2 = *(const int *)key2;
+  return (val1 > val2) - (val1 < val2);
+}
+
+int* box(int v) {
+  int* b = malloc(sizeof(int));
+  *b = v;
+  return b;
+}
+
+/* check ordering, balance and data of a subtree, return its depth or -1 */
+int check(PavlNode* node, int* last, int* count) {
+  int l, r, k;
+  if (!node) {
+    return 0;
+  }
+  l = check(node->left, last, count);
+  k = *(int *)node->key;
+  if (l < 0 || (*count && k <= *last) || (intptr_t)node->data != k) {
+    return -1;
+  }
+  *last = k;
+  (*count)++;
+  r = check(node->right, last, count);
+  if (r < 0 || l - r > 1 || r - l > 1 || node->depth != (l > r ? l : r) + 1) {
+    return -1;
+  }
+  return node->depth;
+}
+
+void* reader(void* p) {
+  reader_arg* arg = p;
+  PavlSnapshot s;
+  PavlNode* first;
+  int last, count;
+
+  while (!atomic_load(arg->done)) {
+    s = pavl_snapshot(arg->tree);
+    count = 0;
+    if (check(s, &last, &count) < 0) {
+      arg->errors++;
+    }
+    /* in_order is read after the snapshot was taken */
+    if (count && atomic_load(arg->in_order)) {
+      for (first = s; first->left; first = first->left) {
+      }
+      if (last - *(int *)first->key + 1 != count) {
+        arg->errors++;
+      }
+    }
+    pavl_release(arg->tree, s);
+    arg->snapshots++;
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 20000;
+  int nreaders = argc > 2 ? atoi(argv[2]) : 4;
+  pthread_t* threads = malloc(nreaders * sizeof(pthread_t));
+  reader_arg* args = malloc(nreaders * sizeof(reader_arg));
+  atomic_int done, in_order;
+  PavlTree tree;
+  long errors = 0, snapshots = 0;
+  int i;
+
+  pavl_initialize(&tree, intcmp, free);
+  atomic_init(&done, 0);
+  atomic_init(&in_order, 1);
+
+  for (i = 0; i < nreaders; i++) {
+    args[i].tree = &tree;
+    args[i].done = &done;
+    args[i].in_order = &in_order;
+    args[i].snapshots = 0;
+    args[i].errors = 0;
+    pthread_create(&threads[i], NULL, reader, &args[i]);
+  }
+
+  for (i = 0; i < n; i++) {
+    errors += pavl_insert(&tree, box(i), (void *)(intptr_t)i) != NULL;
+  }
+  /* replacing data keeps the old snapshots valid */
+  for (i = 0; i < n; i += 7) {
+    errors += pavl_insert(&tree, box(i), (void *)(intptr_t)i)
+              != (void *)(intptr_t)i;
+  }
+  for (i = 0; i < n; i++) {
+    errors += pavl_search(&tree, &i) != (void *)(intptr_t)i;
+  }
+  for (i = 0; i < n / 2; i++) {
+    errors += pavl_remove(&tree, &i) != (void *)(intptr_t)i;
+  }
+  errors += pavl_remove(&tree, &i) == NULL;
+  errors += pavl_remove(&tree, &i) != NULL;
+
+  /* remaining keys in a scattered order, removing inner nodes */
+  atomic_store(&in_order, 0);
+  for (i = 0; i < n; i++) {
+    int k = (int)((i * 7919L) % n);
+    if (k > n / 2) {
+      errors += pavl_remove(&tree, &k) != (void *)(intptr_t)k;
+    }
+  }
+
+  atomic_store(&done, 1);
+  for (i = 0; i < nreaders; i++) {
+    pthread_join(threads[i], NULL);
+    errors += args[i].errors;
+    snapshots += args[i].snapshots;
+  }
+
+  errors += atomic_load(&tree.root) != NULL;
+  pavl_destroy(&tree, NULL);
+
+  printf("%d keys, %d readers, %ld snapshots checked\n",
+         n, nreaders, snapshots);
+  free(threads);
+  free(args);
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+/* Breadth first traversal of an implicit tree with structures/queue.h,
+ * against a linked list queue allocating each element as the previous
+ * version did, then checks of both ends of the deque.
+ * Usage: ./queue [number of nodes]
+ * Exits with 1 if both traversals do not agree. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define Q_IMPLEMENTATION
+#include "../structures/queue.h"
+
+typedef struct Cell {
+  void* data;
+  struct Cell* next;
+} Cell;
+
+typedef struct {
+  Cell* head;
+  Cell* tip;
+} List;
+
+void list_append(List* list, void* data) {
+  Cell* cell = malloc(sizeof(Cell));
+  cell->data = data;
+  cell->next = NULL;
+  if (list->head) {
+    list->tip->next = cell;
+  } else {
+    list->head = cell;
+  }
+  list->tip = cell;
+}
+
+void* list_shift(List* list) {
+  Cell* cell = list->head;
+  void* data = cell->data;
+  list->head = cell->next;
+  free(cell);
+  return data;
+}
+
+double since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  uintptr_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  uintptr_t sum_list = 0, sum_queue = 0, node, order_errors = 0, last = 0;
+  List list = {NULL, NULL};
+  Queue queue = {0};
+  clock_t start;
+  int errors = 0;
+
+  // node i has children 2i+1 and 2i+2, visited in increasing order
+  start = clock();
+  list_append(&list, (void*)0);
+  while (list.head) {
+    node = (uintptr_t)list_shift(&list);
+    sum_list += node;
+    for (uintptr_t c = 2 * node + 1; c <= 2 * node + 2 && c < n; c++) {
+      list_append(&list, (void*)c);
+    }
+  }
+  printf("linked list %9.3fs\n", since(start));
+
+  start = clock();
+  q_unshift(&queue, (void*)0);
+  while (!q_empty(&queue)) {
+    node = (uintptr_t)q_shift(&queue);
+    sum_queue += node;
+    order_errors += node && node != last + 1;
+    last = node;
+    for (uintptr_t c = 2 * node + 1; c <= 2 * node + 2 && c < n; c++) {
+      q_unshift(&queue, (void*)c);
+    }
+  }
+  printf("queue       %9.3fs\n", since(start));
+  errors += sum_list != sum_queue || sum_queue != n * (n - 1) / 2;
+  errors += order_errors != 0;
+  q_destroy(&queue);
+
+  // both ends, wrapping around and growing while wrapped
+  for (uintptr_t i = 1; i <= 10; i++) {
+    q_unshift(&queue, (void*)i);
+  }
+  for (uintptr_t i = 1; i <= 8; i++) {
+    errors += q_shift(&queue) != (void*)i;
+  }
+  for (uintptr_t i = 11; i <= 30; i++) {
+    q_unshift(&queue, (void*)i);
+  }
+  q_push(&queue, (void*)8);
+  errors += queue.capacity != 32 || queue.size != 23;
+  errors += q_pop(&queue) != (void*)30;
+  for (uintptr_t i = 8; i <= 29; i++) {
+    errors += q_shift(&queue) != (void*)i;
+  }
+  errors += !q_empty(&queue) || q_shift(&queue) || q_pop(&queue);
+  errors += !q_reserve(&queue, 100) || queue.capacity < 100;
+  q_destroy(&queue);
+
+  if (errors) {
+    printf("%d errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/* Depth first traversal of an implicit tree with structures/stack.h, against
+ * a linked list stack allocating each element as the previous version did.
+ * Usage: ./stack [number of nodes]
+ * Exits with 1 if both traversals do not agree. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define STK_IMPLEMENTATION
+#include "../structures/stack.h"
+
+typedef struct Cell {
+  void* data;
+  struct Cell* next;
+} Cell;
+
+void list_push(Cell** head, void* data) {
+  Cell* cell = malloc(sizeof(Cell));
+  cell->data = data;
+  cell->next = *head;
+  *head = cell;
+}
+
+void* list_pop(Cell** head) {
+  Cell* cell = *head;
+  void* data = cell->data;
+  *head = cell->next;
+  free(cell);
+  return data;
+}
+
+double since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  uintptr_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  uintptr_t sum_list = 0, sum_stack = 0, node;
+  void* batch[4];
+  Cell* list = NULL;
+  Stack stack = {0};
+  clock_t start;
+  int errors = 0;
+
+  // node i has children 3i+1, 3i+2 and 3i+3, the root is 0
+  start = clock();
+  list_push(&list, (void*)0);
+  while (list) {
+    node = (uintptr_t)list_pop(&list);
+    sum_list += node;
+    for (uintptr_t c = 3 * node + 1; c <= 3 * node + 3 && c < n; c++) {
+      list_push(&list, (void*)c);
+    }
+  }
+  printf("linked list %9.3fs\n", since(start));
+
+  start = clock();
+  stk_push(&stack, (void*)0);
+  while (!stk_empty(&stack)) {
+    node = (uintptr_t)stk_pop(&stack);
+    sum_stack += node;
+    for (uintptr_t c = 3 * node + 1; c <= 3 * node + 3 && c < n; c++) {
+      stk_push(&stack, (void*)c);
+    }
+  }
+  printf("stack       %9.3fs\n", since(start));
+  errors += sum_list != sum_stack || sum_stack != n * (n - 1) / 2;
+
+  // bulk operations
+  errors += !stk_reserve(&stack, 1000) || stack.capacity < 1000;
+  for (uintptr_t i = 0; i < 4; i++) {
+    batch[i] = (void*)(i + 1);
+  }
+  stk_push_n(&stack, batch, 4);
+  stk_push(&stack, (void*)5);
+  errors += stk_pop(&stack) != (void*)5;
+  errors += stk_pop_n(&stack, batch, 3) != 3;
+  errors += batch[0] != (void*)4 || batch[2] != (void*)2;
+  errors += stk_pop_n(&stack, batch, 3) != 1 || batch[0] != (void*)1;
+  errors += !stk_empty(&stack) || stk_pop(&stack) != NULL;
+  stk_destroy(&stack);
+
+  if (errors) {
+    printf("%d errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+/* Checks of structures/tpool.h: thieves steal from a deque while its owner
+ * pushes and pops, every item must be taken once; parallel for against a
+ * serial loop; recursive tasks waiting for their subtasks.
+ * Usage: ./tpool [number of threads]
+ * Exits with 1 on inconsistencies. */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define Q_IMPLEMENTATION
+#define TP_IMPLEMENTATION
+#include "../structures/tpool.h"
+
+#define ITEMS 1000000
+#define THIEVES 3
+
+typedef struct {
+  WsDeque* deque;
+  atomic_int* taken;
+  atomic_int* done;
+} thief_arg;
+
+typedef struct {
+  TpPool* pool;
+  int n;
+  long result;
+} fib_arg;
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// splitmix64 of i, some work to do per index
+uint64_t mix(uint64_t i) {
+  uint64_t z = i * 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+void* thief(void* p) {
+  thief_arg* arg = p;
+  void* item;
+  while (!atomic_load(arg->done)) {
+    if ((item = wsd_steal(arg->deque))) {
+      atomic_fetch_add(&arg->taken[(uintptr_t)item - 1], 1);
+    }
+  }
+  return NULL;
+}
+
+void sum_range(void* arg, size_t begin, size_t end) {
+  uint64_t sum = 0;
+  for (size_t i = begin; i < end; i++) {
+    sum += mix(i);
+  }
+  atomic_fetch_add((_Atomic uint64_t*)arg, sum);
+}
+
+void fib_task(void* p) {
+  fib_arg* arg = p;
+  if (arg->n < 2) {
+    arg->result = arg->n;
+    return;
+  }
+  fib_arg a = {arg->pool, arg->n - 1, 0}, b = {arg->pool, arg->n - 2, 0};
+  TpWaitGroup wg;
+  tp_wg_initialize(&wg);
+  if (!tp_submit(arg->pool, fib_task, &a, &wg)) {
+    fib_task(&a);
+  }
+  fib_task(&b);
+  tp_wait(arg->pool, &wg);
+  tp_wg_destroy(&wg);
+  arg->result = a.result + b.result;
+}
+
+int main(int argc, char** argv) {
+  int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+  atomic_int* taken = calloc(ITEMS, sizeof(atomic_int));
+  pthread_t thieves[THIEVES];
+  atomic_int done;
+  WsDeque deque;
+  TpPool pool;
+  long errors = 0;
+  void* item;
+
+  // owner pushes two items and pops one, thieves take from the other end
+  wsd_initialize(&deque);
+  atomic_init(&done, 0);
+  thief_arg targ = {&deque, taken, &done};
+  for (int i = 0; i < THIEVES; i++) {
+    pthread_create(&thieves[i], NULL, thief, &targ);
+  }
+  for (uintptr_t i = 1; i <= ITEMS; i++) {
+    wsd_push(&deque, (void*)i);
+    if (i % 2 == 0 && (item = wsd_pop(&deque))) {
+      atomic_fetch_add(&taken[(uintptr_t)item - 1], 1);
+    }
+  }
+  while ((item = wsd_pop(&deque))) {
+    atomic_fetch_add(&taken[(uintptr_t)item - 1], 1);
+  }
+  atomic_store(&done, 1);
+  for (int i = 0; i < THIEVES; i++) {
+    pthread_join(thieves[i], NULL);
+  }
+  for (int i = 0; i < ITEMS; i++) {
+    errors += atomic_load(&taken[i]) != 1;
+  }
+  wsd_destroy(&deque);
+  free(taken);
+
+  tp_initialize(&pool, nthreads);
+  printf("%d workers\n", nthreads);
+
+  uint64_t serial = 0;
+  double start = now();
+  for (size_t i = 0; i < 50000000; i++) {
+    serial += mix(i);
+  }
+  printf("serial loop  %9.3fs\n", now() - start);
+  _Atomic uint64_t parallel = 0;
+  start = now();
+  tp_parallel_for(&pool, 0, 50000000, 100000, sum_range, &parallel);
+  printf("parallel for %9.3fs\n", now() - start);
+  errors += atomic_load(&parallel) != serial;
+
+  fib_arg fib = {&pool, 20, 0};
+  start = now();
+  fib_task(&fib);
+  printf("fib tasks    %9.3fs\n", now() - start);
+  errors += fib.result != 6765;
+
+  // submitted from outside and never waited for, destroy runs it
+  fib_arg late = {&pool, 15, 0};
+  errors += !tp_submit(&pool, fib_task, &late, NULL);
+  tp_destroy(&pool);
+  errors += late.result != 610;
+
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}
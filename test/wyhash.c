@@ -0,0 +1,206 @@
+/* Check hash/wyhash.h against the test vectors of the reference wyhash,
+ * its avalanche on short keys and its seeds, then use it as the hash
+ * function of structures/hashtable.h for the words of
+ * test/all_english_words.txt and check hashn_many against hashn. Times
+ * hashn on a large buffer and on the words, against the djb2 hash of
+ * ht_string_hash_function, and hashn_many on the words.
+ * Usage: ./wyhash [buffer size in MB]
+ * Exits with 1 if a vector, a word or the avalanche is wrong. */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define WYHASH_IMPLEMENTATION
+#include "../hash/wyhash.h"
+#define HASHTABLE_IMPLEMENTATION
+#include "../structures/hashtable.h"
+#define SPLITMIX64_IMPL
+#include "../rng/splitmix64.h"
+
+#define MAX_WORDS 300000
+
+double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int strcmp_keys(const void* key1, const void* key2) {
+  return strcmp(key1, key2);
+}
+
+// mean number of output bits flipped by flipping one bit of a random key
+double avalanche(size_t length, uint64_t seed) {
+  uint8_t key[64];
+  long flipped = 0, trials = 0;
+  for (int round = 0; round < 200; round++) {
+    for (size_t i = 0; i < length; i++) {
+      key[i] = (uint8_t)next();
+    }
+    uint64_t h = wyhash_seeded(key, length, seed);
+    for (size_t bit = 0; bit < length * 8; bit++) {
+      key[bit / 8] ^= 1 << (bit % 8);
+      flipped += __builtin_popcountll(h ^ wyhash_seeded(key, length, seed));
+      key[bit / 8] ^= 1 << (bit % 8);
+      trials++;
+    }
+  }
+  return trials ? (double)flipped / trials : 32;
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+  // vectors of the reference implementation, the seed is the index
+  const char* messages[] = {
+    "", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+    "1234567890123456789012345678901234567890"
+    "1234567890123456789012345678901234567890"
+  };
+  const uint64_t vectors[] = {
+    0x93228a4de0eec5a2ull, 0xc5bac3db178713c4ull, 0xa97f2f7b1d9b3314ull,
+    0x786d1f1df3801df4ull, 0xdca5a8138ad37c87ull, 0xb9e734f117cfaf70ull,
+    0x6cc5eab49a92d617ull
+  };
+  long errors = 0;
+
+  for (int i = 0; i < 7; i++) {
+    errors += wyhash_seeded((const uint8_t*)messages[i], strlen(messages[i]),
+                            i) != vectors[i];
+  }
+  errors += hash("abc") != hashn((const uint8_t*)"abc", 3);
+
+  // every length of the short paths, seeds change every hash
+  seed(42);
+  for (size_t length = 1; length <= 64; length++) {
+    double bits = avalanche(length, 0);
+    errors += bits < 31 || bits > 33;
+    errors += avalanche(length, 12345) < 31;
+    uint8_t key[64] = {0};
+    errors += wyhash_seeded(key, length, 1) == wyhash_seeded(key, length, 2);
+  }
+
+  uint8_t* buf = malloc(size + 8);
+  for (size_t i = 0; i < size + 8; i++) {
+    buf[i] = (uint8_t)(next() >> 56);
+  }
+
+  // batches of every path, from empty keys to the 48 byte loop
+  const uint8_t* contents[100];
+  size_t sizes[100];
+  uint64_t digests[100];
+  for (size_t n = 0; n <= 100; n++) {
+    for (size_t i = 0; i < n; i++) {
+      contents[i] = buf + next() % 4096;
+      sizes[i] = next() % 120;
+    }
+    hashn_many(contents, sizes, n, digests);
+    for (size_t i = 0; i < n; i++) {
+      errors += digests[i] != hashn(contents[i], sizes[i]);
+    }
+  }
+  double start = now();
+  uint64_t h = hashn(buf + 1, size);
+  double elapsed = now() - start;
+  printf("%zuMB buffer: %.3fs, %.1f MB/s (%016llx)\n", size >> 20, elapsed,
+         size / elapsed * 1e-6, (unsigned long long)h);
+  free(buf);
+
+  // words as hash table keys
+  FILE* f = fopen("test/all_english_words.txt", "r");
+  if (!f) {
+    f = fopen("all_english_words.txt", "r");
+  }
+  if (!f) {
+    printf("all_english_words.txt not found\n");
+    return 1;
+  }
+  char** words = malloc(MAX_WORDS * sizeof(char*));
+  char line[256];
+  size_t nwords = 0;
+  while (nwords < MAX_WORDS && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    words[nwords++] = strdup(line);
+  }
+  fclose(f);
+
+  unsigned long (*fns[])(const void*) = {
+    ht_string_hash_function, wyhash_string
+  };
+  const char* names[] = { "djb2", "wyhash" };
+  for (int k = 0; k < 2; k++) {
+    unsigned long sum = 0;
+    start = now();
+    for (int round = 0; round < 10; round++) {
+      for (size_t i = 0; i < nwords; i++) {
+        sum += fns[k](words[i]);
+      }
+    }
+    elapsed = now() - start;
+
+    wyhash_set_seed(next());
+    HashTable* table = ht_create(nwords / 3 | 1);
+    ht_set_hash_function(table, fns[k]);
+    ht_set_key_comparison_function(table, strcmp_keys);
+    for (size_t i = 0; i < nwords; i++) {
+      ht_put(table, words[i], words[i]);
+    }
+    long longest = 0;
+    for (long b = 0; b < table->numOfBuckets; b++) {
+      long chain = 0;
+      for (KeyValuePair* pair = table->bucketArray[b]; pair;
+           pair = pair->next) {
+        chain++;
+      }
+      longest = chain > longest ? chain : longest;
+    }
+    for (size_t i = 0; i < nwords; i++) {
+      const char* found = ht_get(table, words[i]);
+      errors += !found || strcmp(found, words[i]);
+    }
+    printf("%-7s %zu words: %.1f ns per key, longest chain %ld (%lx)\n",
+           names[k], nwords, elapsed / nwords / 10 * 1e9, longest, sum & 0xF);
+    ht_destroy(table);
+  }
+
+  // the same words as one batch
+  size_t* lengths = malloc(nwords * sizeof(size_t));
+  uint64_t* hashes = malloc(nwords * sizeof(uint64_t));
+  for (size_t i = 0; i < nwords; i++) {
+    lengths[i] = strlen(words[i]);
+  }
+  uint64_t sum = 0;
+  start = now();
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < nwords; i++) {
+      sum += hashn((const uint8_t*)words[i], lengths[i]);
+    }
+  }
+  elapsed = now() - start;
+  printf("%-10s %zu words: %.1f ns per key (%llx)\n", "hashn", nwords,
+         elapsed / nwords / 10 * 1e9, (unsigned long long)sum & 0xF);
+  start = now();
+  for (int round = 0; round < 10; round++) {
+    hashn_many((const uint8_t* const*)words, lengths, nwords, hashes);
+  }
+  elapsed = now() - start;
+  for (size_t i = 0; i < nwords; i++) {
+    errors += hashes[i] != hashn((const uint8_t*)words[i], lengths[i]);
+  }
+  printf("%-10s %zu words: %.1f ns per key\n", "hashn_many", nwords,
+         elapsed / nwords / 10 * 1e9);
+
+  for (size_t i = 0; i < nwords; i++) {
+    free(words[i]);
+  }
+  free(words);
+  free(lengths);
+  free(hashes);
+  if (errors) {
+    printf("%ld errors\n", errors);
+    return 1;
+  }
+  return 0;
+}